@@ -0,0 +1,53 @@
+#!/bin/sh
+#
+# compare.sh: runs the same traces against mm.c, tmp_mm.c and the system
+# allocator and prints one table, with each trace's rows side by side.
+#
+#     bench/compare.sh [mmbench options] [trace.rep ...]
+#
+# Each allocator is linked into its own mmbench binary, built in $OUT
+# (default: a temporary directory) with $CC and $CFLAGS. memlib.c and the
+# headers are taken from $MEMLIB_DIR, by default the directory of mm.c.
+# Without trace arguments the synthetic traces (generated into $OUT by
+# gentraces.sh) and the recorded ones in bench/traces are run.
+
+set -e
+
+bench=$(cd "$(dirname "$0")" && pwd)
+root=$(dirname "$bench")
+MEMLIB_DIR=${MEMLIB_DIR:-$root}
+CC=${CC:-gcc}
+CFLAGS=${CFLAGS:--O2}
+OUT=${OUT:-$(mktemp -d)}
+
+opts=
+while [ $# -gt 0 ]; do
+    case $1 in
+        -n) opts="$opts -n $2"; shift 2 ;;
+        -c) opts="$opts -c"; shift ;;
+        -t) opts="$opts -t"; shift ;;
+        -*) echo "usage: $0 [-n reps] [-c] [-t] [trace.rep ...]" >&2; exit 2 ;;
+        *) break ;;
+    esac
+done
+if [ $# -eq 0 ]; then
+    set -- $("$bench/gentraces.sh" "$OUT/traces") "$bench"/traces/*.rep
+fi
+
+build() {
+    $CC $CFLAGS -DDRIVER -pthread -I"$root" -I"$MEMLIB_DIR" \
+        -o "$OUT/mmbench-$1" "$bench/mmbench.c" "$2" "$MEMLIB_DIR/memlib.c"
+}
+build mm "$root/mm.c"
+build tmp_mm "$root/tmp_mm.c"
+build libc "$bench/mm_libc.c"
+
+for alloc in mm tmp_mm libc; do
+    "$OUT/mmbench-$alloc" $opts -l $alloc "$@" > "$OUT/$alloc.txt" || true
+done
+
+# Keep the header of the first run, then group the rows by trace name
+awk 'FNR <= 2 { if (NR == FNR) print; next }
+     { if (!($1 in rows)) order[n++] = $1; rows[$1] = rows[$1] $0 "\n" }
+     END { for (i = 0; i < n; i++) printf "%s\n", rows[order[i]] }' \
+    "$OUT/mm.txt" "$OUT/tmp_mm.txt" "$OUT/libc.txt"
@@ -0,0 +1,31 @@
+#!/bin/sh
+#
+# gentraces.sh: builds mmtrace and generates the synthetic traces into a
+# directory, then prints their paths, one per line.
+#
+#     bench/gentraces.sh [dir]
+#
+# The traces are not kept in the tree; the workload, number of operations
+# and seed below pin each one down, as mmtrace always gives the same trace
+# for them. dir defaults to a temporary directory; mmtrace is built there
+# with $CC.
+
+set -e
+
+bench=$(cd "$(dirname "$0")" && pwd)
+CC=${CC:-gcc}
+dir=${1:-$(mktemp -d)}
+
+mkdir -p "$dir"
+$CC -O2 -o "$dir/mmtrace" "$bench/mmtrace.c"
+
+# workload  ops    seed
+while read -r workload ops seed; do
+    "$dir/mmtrace" "$workload" "$ops" "$seed" > "$dir/$workload.rep"
+    echo "$dir/$workload.rep"
+done <<EOF
+http        40000  1
+json        40000  1
+kvcache     40000  1
+session     40000  1
+EOF
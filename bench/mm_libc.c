@@ -0,0 +1,74 @@
+/*
+ * mm_libc.c
+ *
+ * The system allocator behind the mm.h interface, as a baseline for
+ * mmbench. Link it in place of mm.c:
+ *
+ *     gcc -O2 -pthread -I. -o mmbench-libc bench/mmbench.c bench/mm_libc.c memlib.c
+ *
+ * glibc does not allocate from the memlib heap, so mm_bench_heapsize
+ * reports what glibc has handed out instead (see mmbench.c).
+ */
+#include <stdlib.h>
+#include <stdbool.h>
+#include <malloc.h>
+
+#include "mm.h"
+
+/* Bytes in use by the benchmark itself when the replay started */
+static size_t base_in_use;
+
+/*
+ * mm_init: hands memory kept from earlier replays back to the OS, so that
+ *          every replay starts from a similar footprint, and notes what the
+ *          benchmark itself is using.
+ */
+bool mm_init(void)
+{
+    malloc_trim(0);
+    struct mallinfo2 mi = mallinfo2();
+    base_in_use = mi.uordblks + mi.hblkhd;
+    return true;
+}
+
+void *mm_malloc(size_t size)
+{
+    return malloc(size);
+}
+
+void mm_free(void *ptr)
+{
+    free(ptr);
+}
+
+void *mm_realloc(void *ptr, size_t size)
+{
+    return realloc(ptr, size);
+}
+
+void *mm_calloc(size_t nmemb, size_t size)
+{
+    return calloc(nmemb, size);
+}
+
+bool mm_checkheap(int lineno)
+{
+    (void)lineno;
+    return true;
+}
+
+/*
+ * mm_bench_heapsize: bytes glibc has handed out, chunk overhead included,
+ *                    less those the benchmark itself used at mm_init. Its
+ *                    footprint would be the better measure, but free chunks
+ *                    between the benchmark's own blocks keep it from
+ *                    shrinking between replays, so a replay may grow it by
+ *                    far less than it uses. Free chunks within the replay
+ *                    are not counted, which flatters glibc's utilization.
+ */
+size_t mm_bench_heapsize(void)
+{
+    struct mallinfo2 mi = mallinfo2();
+    size_t in_use = mi.uordblks + mi.hblkhd;
+    return (in_use > base_in_use) ? in_use - base_in_use : 0;
+}
@@ -0,0 +1,527 @@
+/*
+ * mmbench.c
+ *
+ * Trace-driven benchmark for mm.c. Replays allocation traces against
+ * mm_malloc/mm_free/mm_realloc and reports throughput, per-operation
+ * latency percentiles and peak heap utilization.
+ *
+ * Build from the directory holding mm.c, memlib.c and their headers:
+ *
+ *     gcc -O2 -DDRIVER -pthread -I. -o mmbench bench/mmbench.c mm.c memlib.c
+ *
+ * Usage: mmbench [-n reps] [-c] [-t] [-l label] trace.rep ...
+ *     -n reps  replay every trace reps times for throughput and keep the
+ *              fastest (default 5)
+ *     -c       check every payload for alignment, overlap and corruption
+ *     -t       count data TLB misses (loads and stores, user space) during
+ *              the timed replays with perf_event_open, in an extra column;
+ *              "-" where the counters are not available
+ *     -l label name the allocator in an extra column
+ *
+ * bench/compare.sh builds mmbench against mm.c, tmp_mm.c and the system
+ * allocator (bench/mm_libc.c) and merges their results into one table.
+ *
+ * Traces use the malloc lab .rep format: four header lines (suggested heap
+ * size, number of ids, number of operations, weight), then one operation
+ * per line:
+ *     a <id> <size>    allocate size bytes as id
+ *     r <id> <size>    reallocate id to size bytes
+ *     f <id>           free id
+ * bench/traces holds traces recorded from real programs (with mmrecord).
+ * Synthetic server workloads come from mmtrace; bench/gentraces.sh lists
+ * the ones used and generates them at bench time.
+ *
+ * Each trace is replayed three ways. A first replay measures utilization:
+ * the peak of live requested bytes over the peak heap size. Timed replays
+ * without any per-operation work give the throughput. A last replay reads
+ * the timestamp counter around every call for the latency percentiles,
+ * which therefore include the cost of reading it.
+ *
+ * To see what huge pages do for a trace, compare TLB misses with and
+ * without mm.c's huge page mode:
+ *
+ *     gcc -O2 -DDRIVER -pthread -I. -o mmbench bench/mmbench.c mm.c memlib.c
+ *     gcc -O2 -DDRIVER -DMM_HUGE=1 -pthread -I. -o mmbench-huge \
+ *         bench/mmbench.c mm.c memlib.c
+ *     ./mmbench -t trace.rep; ./mmbench-huge -t trace.rep
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#endif
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define TICK_UNIT "cycles"
+#else
+#define TICK_UNIT "ns"
+#endif
+
+#include "mm.h"
+#include "memlib.h"
+
+typedef struct op {
+    char type;                  // 'a', 'r' or 'f'
+    unsigned id;
+    size_t size;
+} op_t;
+
+typedef struct trace {
+    const char *name;
+    unsigned num_ids;
+    size_t num_ops;
+    op_t *ops;
+} trace_t;
+
+typedef struct result {
+    double seconds;             // fastest timed replay
+    double util;
+    uint64_t pct[5];            // p50, p90, p99, p99.9, max
+    double tlb_misses;          // per operation, < 0 if not counted
+    bool ok;
+} result_t;
+
+static const double pct_points[5] = { 0.50, 0.90, 0.99, 0.999, 1.0 };
+
+static bool check_payloads = false;
+static bool count_tlb = false;
+static const char *label = NULL;
+
+/* Data TLB load and store miss counters, -1 where unavailable */
+static int tlb_fds[2] = { -1, -1 };
+
+/*
+ * Allocators that do not take their memory from the memlib heap, such as
+ * the system allocator in mm_libc.c, define mm_bench_heapsize to report
+ * their footprint; their payloads are not checked against the heap bounds.
+ */
+size_t mm_bench_heapsize(void) __attribute__((weak));
+
+static size_t heap_size(void)
+{
+    return (mm_bench_heapsize != NULL) ? mm_bench_heapsize() : mem_heapsize();
+}
+
+/*
+ * ticks: a fine-grained timestamp; CPU cycles where the timestamp counter
+ *        is available, nanoseconds otherwise.
+ */
+static inline uint64_t ticks(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+#endif
+}
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/*
+ * tlb_open: opens the data TLB miss counters of the calling thread,
+ *           disabled. Either may fail, e.g. on CPUs without store misses.
+ */
+static void tlb_open(void)
+{
+#ifdef __linux__
+    static const uint64_t ops[2] = {
+        PERF_COUNT_HW_CACHE_OP_READ, PERF_COUNT_HW_CACHE_OP_WRITE
+    };
+    for (int i = 0; i < 2; i++) {
+        struct perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.type = PERF_TYPE_HW_CACHE;
+        attr.size = sizeof(attr);
+        attr.config = PERF_COUNT_HW_CACHE_DTLB | (ops[i] << 8)
+                      | ((uint64_t)PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+        attr.disabled = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        tlb_fds[i] = (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+    }
+#endif
+    if (tlb_fds[0] < 0 && tlb_fds[1] < 0) {
+        fprintf(stderr, "mmbench: TLB miss counters not available\n");
+    }
+}
+
+/*
+ * tlb_start/tlb_stop: count TLB misses between the two calls; tlb_stop
+ *                     returns their number, or -1 without counters.
+ */
+static void tlb_start(void)
+{
+#ifdef __linux__
+    for (int i = 0; i < 2; i++) {
+        if (tlb_fds[i] >= 0) {
+            ioctl(tlb_fds[i], PERF_EVENT_IOC_RESET, 0);
+            ioctl(tlb_fds[i], PERF_EVENT_IOC_ENABLE, 0);
+        }
+    }
+#endif
+}
+
+static int64_t tlb_stop(void)
+{
+    int64_t total = -1;
+#ifdef __linux__
+    for (int i = 0; i < 2; i++) {
+        uint64_t n;
+        if (tlb_fds[i] >= 0) {
+            ioctl(tlb_fds[i], PERF_EVENT_IOC_DISABLE, 0);
+            if (read(tlb_fds[i], &n, sizeof(n)) == sizeof(n)) {
+                total = (total < 0) ? (int64_t)n : total + (int64_t)n;
+            }
+        }
+    }
+#endif
+    return total;
+}
+
+/*
+ * read_trace: parses a .rep file. Returns false, after printing why, if
+ *             the file cannot be read or an operation is malformed.
+ */
+static bool read_trace(const char *path, trace_t *trace)
+{
+    FILE *fp = fopen(path, "r");
+    unsigned long heap_size, num_ids, num_ops, weight;
+
+    if (fp == NULL) {
+        perror(path);
+        return false;
+    }
+    if (fscanf(fp, "%lu %lu %lu %lu", &heap_size, &num_ids, &num_ops, &weight) != 4) {
+        fprintf(stderr, "%s: bad header\n", path);
+        fclose(fp);
+        return false;
+    }
+    const char *name = strrchr(path, '/');
+    trace->name = (name != NULL) ? name + 1 : path;
+    trace->num_ids = num_ids;
+    trace->num_ops = 0;
+    trace->ops = malloc(num_ops * sizeof(op_t));
+    if (trace->ops == NULL) {
+        fprintf(stderr, "%s: out of memory\n", path);
+        fclose(fp);
+        return false;
+    }
+
+    char type[2];
+    while (trace->num_ops < num_ops && fscanf(fp, "%1s", type) == 1) {
+        op_t *op = &trace->ops[trace->num_ops];
+        unsigned long size = 0;
+        int n = (type[0] == 'f') ? fscanf(fp, "%u", &op->id)
+                                 : fscanf(fp, "%u %lu", &op->id, &size);
+        if ((type[0] != 'a' && type[0] != 'r' && type[0] != 'f')
+            || n != ((type[0] == 'f') ? 1 : 2) || op->id >= num_ids) {
+            fprintf(stderr, "%s: bad operation %zu\n", path, trace->num_ops);
+            fclose(fp);
+            return false;
+        }
+        op->type = type[0];
+        op->size = size;
+        trace->num_ops++;
+    }
+    fclose(fp);
+    return true;
+}
+
+/*
+ * fill/verify: stamp a payload with a byte derived from its id, and check
+ *              that the first n bytes still carry it.
+ */
+static void fill(unsigned char *p, size_t n, unsigned id)
+{
+    memset(p, (int)(id * 31 + 7) & 0xFF, n);
+}
+
+static bool verify(const unsigned char *p, size_t n, unsigned id)
+{
+    unsigned char c = (unsigned char)(id * 31 + 7);
+    for (size_t i = 0; i < n; i++) {
+        if (p[i] != c) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/*
+ * replay: runs the trace once against a fresh heap. With lat != NULL the
+ *         duration of every call is stored in lat; with util != NULL the
+ *         peak utilization is computed (and payloads checked if -c).
+ *         Returns false if the allocator failed or corrupted a payload.
+ */
+static bool replay(const trace_t *trace, void **ptrs, size_t *sizes,
+                   uint64_t *lat, double *util)
+{
+    size_t live = 0, peak_live = 0, peak_heap = 0;
+    bool checking = (util != NULL) && check_payloads;
+
+    mem_reset_brk();
+    if (!mm_init()) {
+        fprintf(stderr, "%s: mm_init failed\n", trace->name);
+        return false;
+    }
+    memset(ptrs, 0, trace->num_ids * sizeof(void *));
+
+    for (size_t i = 0; i < trace->num_ops; i++) {
+        const op_t *op = &trace->ops[i];
+        uint64_t t0 = 0;
+        void *p;
+
+        if (lat != NULL) {
+            t0 = ticks();
+        }
+        switch (op->type) {
+        case 'a':
+            p = mm_malloc(op->size);
+            break;
+        case 'r':
+            if (checking && !verify(ptrs[op->id], sizes[op->id], op->id)) {
+                fprintf(stderr, "%s: op %zu: payload %u corrupted\n", trace->name, i, op->id);
+                return false;
+            }
+            p = mm_realloc(ptrs[op->id], op->size);
+            break;
+        default:
+            if (checking && !verify(ptrs[op->id], sizes[op->id], op->id)) {
+                fprintf(stderr, "%s: op %zu: payload %u corrupted\n", trace->name, i, op->id);
+                return false;
+            }
+            mm_free(ptrs[op->id]);
+            p = NULL;
+            break;
+        }
+        if (lat != NULL) {
+            lat[i] = ticks() - t0;
+        }
+
+        if (op->type != 'f' && p == NULL && op->size != 0) {
+            fprintf(stderr, "%s: op %zu: allocation of %zu bytes failed\n",
+                    trace->name, i, op->size);
+            return false;
+        }
+        if (checking && p != NULL) {
+            if (((uintptr_t)p & 15) != 0 || (mm_bench_heapsize == NULL
+                && ((char *)p < (char *)mem_heap_lo()
+                    || (char *)p + op->size - 1 > (char *)mem_heap_hi()))) {
+                fprintf(stderr, "%s: op %zu: bad payload address %p\n", trace->name, i, p);
+                return false;
+            }
+            // realloc keeps the old bytes; stamp only the new tail
+            size_t kept = 0;
+            if (op->type == 'r') {
+                kept = (sizes[op->id] < op->size) ? sizes[op->id] : op->size;
+            }
+            if (!verify(p, kept, op->id)) {
+                fprintf(stderr, "%s: op %zu: realloc lost payload %u\n", trace->name, i, op->id);
+                return false;
+            }
+            fill((unsigned char *)p + kept, op->size - kept, op->id);
+        }
+        if (util != NULL) {
+            live -= (op->type == 'a') ? 0 : sizes[op->id];
+            live += (op->type == 'f') ? 0 : op->size;
+            peak_live = (live > peak_live) ? live : peak_live;
+            size_t heap = heap_size();
+            peak_heap = (heap > peak_heap) ? heap : peak_heap;
+        }
+        ptrs[op->id] = p;
+        sizes[op->id] = (op->type == 'f') ? 0 : op->size;
+    }
+    if (util != NULL) {
+        *util = (peak_heap > 0) ? (double)peak_live / peak_heap : 0.0;
+    }
+    return true;
+}
+
+/*
+ * release_all: frees whatever the last replay left allocated, which
+ *              matters for allocators that mem_reset_brk does not reset.
+ */
+static void release_all(const trace_t *trace, void **ptrs)
+{
+    for (unsigned id = 0; id < trace->num_ids; id++) {
+        mm_free(ptrs[id]);
+        ptrs[id] = NULL;
+    }
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a;
+    uint64_t y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+/*
+ * print_name: the leading column(s) of a row: trace name and, with -l,
+ *             the allocator.
+ */
+static void print_name(const char *name, const char *alloc)
+{
+    printf("%-24s", name);
+    if (label != NULL) {
+        printf(" %-10s", alloc);
+    }
+}
+
+/*
+ * run_trace: utilization, throughput and latency replays of one trace.
+ */
+static result_t run_trace(const trace_t *trace, int reps)
+{
+    result_t res = { .ok = false };
+    void **ptrs = calloc(trace->num_ids + 1, sizeof(void *));
+    size_t *sizes = calloc(trace->num_ids + 1, sizeof(size_t));
+    uint64_t *lat = calloc(trace->num_ops + 1, sizeof(uint64_t));
+
+    if (ptrs == NULL || sizes == NULL || lat == NULL) {
+        fprintf(stderr, "%s: out of memory\n", trace->name);
+        goto out;
+    }
+    if (!replay(trace, ptrs, sizes, NULL, &res.util)) {
+        goto out;
+    }
+    release_all(trace, ptrs);
+    res.seconds = 1e30;
+    res.tlb_misses = -1;
+    int64_t misses = 0;
+    for (int r = 0; r < reps; r++) {
+        if (count_tlb) {
+            tlb_start();
+        }
+        double t0 = now();
+        if (!replay(trace, ptrs, sizes, NULL, NULL)) {
+            goto out;
+        }
+        double t = now() - t0;
+        int64_t n = count_tlb ? tlb_stop() : -1;
+        misses = (n < 0 || misses < 0) ? -1 : misses + n;
+        res.seconds = (t < res.seconds) ? t : res.seconds;
+        release_all(trace, ptrs);
+    }
+    if (count_tlb && misses >= 0 && trace->num_ops > 0) {
+        res.tlb_misses = (double)misses / reps / trace->num_ops;
+    }
+    if (!replay(trace, ptrs, sizes, lat, NULL)) {
+        goto out;
+    }
+    release_all(trace, ptrs);
+    if (trace->num_ops > 0) {
+        qsort(lat, trace->num_ops, sizeof(uint64_t), cmp_u64);
+        for (int k = 0; k < 5; k++) {
+            size_t idx = (size_t)(pct_points[k] * (trace->num_ops - 1));
+            res.pct[k] = lat[idx];
+        }
+    }
+    res.ok = true;
+out:
+    free(ptrs);
+    free(sizes);
+    free(lat);
+    return res;
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr, "usage: %s [-n reps] [-c] [-t] [-l label] trace.rep ...\n", prog);
+    exit(2);
+}
+
+int main(int argc, char **argv)
+{
+    int reps = 5;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:ctl:")) != -1) {
+        switch (opt) {
+        case 'n':
+            reps = atoi(optarg);
+            break;
+        case 'c':
+            check_payloads = true;
+            break;
+        case 't':
+            count_tlb = true;
+            break;
+        case 'l':
+            label = optarg;
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+    if (optind >= argc || reps < 1) {
+        usage(argv[0]);
+    }
+
+    mem_init();
+    if (count_tlb) {
+        tlb_open();
+    }
+    print_name("trace", "allocator");
+    printf(" %9s %8s %7s %7s %7s %7s %9s %6s", "ops", "Mops/s",
+           "p50", "p90", "p99", "p99.9", "max", "util");
+    printf(count_tlb ? " %9s\n" : "\n", "dTLB/op");
+    print_name("", "");
+    printf(" %9s %8s%42s\n", "", "", "(" TICK_UNIT " per op)");
+
+    size_t total_ops = 0;
+    double total_seconds = 0, total_util = 0;
+    int ntraces = 0, failed = 0;
+    for (int i = optind; i < argc; i++) {
+        trace_t trace;
+        if (!read_trace(argv[i], &trace)) {
+            failed++;
+            continue;
+        }
+        result_t res = run_trace(&trace, reps);
+        print_name(trace.name, label);
+        if (!res.ok) {
+            printf(" %9zu  FAILED\n", trace.num_ops);
+            failed++;
+        } else {
+            printf(" %9zu %8.2f %7lu %7lu %7lu %7lu %9lu %5.1f%%",
+                   trace.num_ops, trace.num_ops / res.seconds / 1e6,
+                   (unsigned long)res.pct[0], (unsigned long)res.pct[1],
+                   (unsigned long)res.pct[2], (unsigned long)res.pct[3],
+                   (unsigned long)res.pct[4], 100 * res.util);
+            if (count_tlb && res.tlb_misses >= 0) {
+                printf(" %9.3f", res.tlb_misses);
+            } else if (count_tlb) {
+                printf(" %9s", "-");
+            }
+            printf("\n");
+            total_ops += trace.num_ops;
+            total_seconds += res.seconds;
+            total_util += res.util;
+            ntraces++;
+        }
+        free(trace.ops);
+    }
+    if (ntraces > 0) {
+        print_name("total", label);
+        printf(" %9zu %8.2f%42s %5.1f%%\n", total_ops,
+               total_ops / total_seconds / 1e6, "", 100 * total_util / ntraces);
+    }
+    mem_deinit();
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,218 @@
+/*
+ * mmrecord.c
+ *
+ * Records the malloc/calloc/realloc/free calls of a running program as a
+ * .rep trace for mmbench. Build it as a preload library and run the
+ * program under it:
+ *
+ *     gcc -O2 -shared -fPIC -o mmrecord.so bench/mmrecord.c
+ *     MMRECORD_OUT=trace.rep MMRECORD_MAX=50000 LD_PRELOAD=./mmrecord.so prog
+ *
+ * The calls are passed on to glibc's own allocator. Recording stops after
+ * MMRECORD_MAX operations (default 100000) and the trace is written when
+ * the program exits. Frees of memory that was not recorded (allocated
+ * before recording started, or by memalign and friends) are dropped.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void __libc_free(void *ptr);
+
+typedef struct op {
+    char type;
+    unsigned id;
+    size_t size;
+} op_t;
+
+/* Live recorded pointers, open addressing with tombstones */
+typedef struct slot {
+    void *ptr;                  // NULL: empty, TOMBSTONE: deleted
+    unsigned id;
+} slot_t;
+
+#define TOMBSTONE ((void *)1)
+
+static op_t *ops;
+static size_t num_ops, max_ops;
+static unsigned num_ids;
+static slot_t *table;
+static size_t table_size;       // power of two, at least 2 * max_ops
+static size_t peak_live, live;
+static size_t *id_size;
+static bool recording;
+static int lock;
+
+static void acquire(void)
+{
+    while (__atomic_exchange_n(&lock, 1, __ATOMIC_ACQUIRE)) {
+        while (__atomic_load_n(&lock, __ATOMIC_RELAXED)) {
+        }
+    }
+}
+
+static void release(void)
+{
+    __atomic_store_n(&lock, 0, __ATOMIC_RELEASE);
+}
+
+static size_t hash(void *ptr)
+{
+    uint64_t h = (uint64_t)(uintptr_t)ptr * 0x9E3779B97F4A7C15ULL;
+    return (size_t)(h >> 20) & (table_size - 1);
+}
+
+/*
+ * lookup: the slot holding ptr, or NULL if ptr is not recorded.
+ */
+static slot_t *lookup(void *ptr)
+{
+    for (size_t i = hash(ptr);; i = (i + 1) & (table_size - 1)) {
+        if (table[i].ptr == ptr) {
+            return &table[i];
+        }
+        if (table[i].ptr == NULL) {
+            return NULL;
+        }
+    }
+}
+
+static void insert(void *ptr, unsigned id)
+{
+    size_t i = hash(ptr);
+    while (table[i].ptr != NULL && table[i].ptr != TOMBSTONE) {
+        i = (i + 1) & (table_size - 1);
+    }
+    table[i].ptr = ptr;
+    table[i].id = id;
+}
+
+/*
+ * record: appends one operation; the caller holds the lock. Allocations
+ *         get a fresh id, frees and reallocs use the id of old.
+ */
+static void record(char type, void *old, void *ptr, size_t size)
+{
+    slot_t *slot = NULL;
+
+    if (!recording || num_ops == max_ops) {
+        return;
+    }
+    if (type != 'a') {
+        slot = lookup(old);
+        if (slot == NULL) {
+            return;
+        }
+    }
+    unsigned id = (slot != NULL) ? slot->id : num_ids++;
+    if (slot != NULL) {
+        slot->ptr = TOMBSTONE;
+        live -= id_size[id];
+    }
+    if (type != 'f') {
+        insert(ptr, id);
+        id_size[id] = size;
+        live += size;
+        peak_live = (live > peak_live) ? live : peak_live;
+    }
+    ops[num_ops++] = (op_t){ type, id, size };
+}
+
+static void write_trace(void)
+{
+    const char *path = getenv("MMRECORD_OUT");
+    FILE *fp;
+
+    acquire();
+    recording = false;
+    release();
+    fp = fopen((path != NULL) ? path : "mmrecord.rep", "w");
+    if (fp == NULL) {
+        return;
+    }
+    fprintf(fp, "%zu\n%u\n%zu\n1\n", peak_live, num_ids, num_ops);
+    for (size_t i = 0; i < num_ops; i++) {
+        if (ops[i].type == 'f') {
+            fprintf(fp, "f %u\n", ops[i].id);
+        } else {
+            fprintf(fp, "%c %u %zu\n", ops[i].type, ops[i].id, ops[i].size);
+        }
+    }
+    fclose(fp);
+}
+
+__attribute__((constructor))
+static void start(void)
+{
+    const char *max = getenv("MMRECORD_MAX");
+
+    max_ops = (max != NULL) ? strtoul(max, NULL, 10) : 100000;
+    for (table_size = 1024; table_size < 2 * max_ops; table_size *= 2) {
+    }
+    ops = __libc_malloc(max_ops * sizeof(op_t));
+    id_size = __libc_malloc(max_ops * sizeof(size_t));
+    table = __libc_calloc(table_size, sizeof(slot_t));
+    if (ops == NULL || id_size == NULL || table == NULL) {
+        return;
+    }
+    atexit(write_trace);
+    recording = true;
+}
+
+void *malloc(size_t size)
+{
+    void *p = __libc_malloc(size);
+    if (p != NULL) {
+        acquire();
+        record('a', NULL, p, size);
+        release();
+    }
+    return p;
+}
+
+void *calloc(size_t nmemb, size_t size)
+{
+    void *p = __libc_calloc(nmemb, size);
+    if (p != NULL) {
+        acquire();
+        record('a', NULL, p, nmemb * size);
+        release();
+    }
+    return p;
+}
+
+void *realloc(void *ptr, size_t size)
+{
+    if (ptr == NULL) {
+        return malloc(size);
+    }
+    if (size == 0) {
+        free(ptr);
+        return NULL;
+    }
+    // Hold the lock across the call so ptr cannot be reused in between
+    acquire();
+    void *p = __libc_realloc(ptr, size);
+    if (p != NULL) {
+        record('r', ptr, p, size);
+    }
+    release();
+    return p;
+}
+
+void free(void *ptr)
+{
+    if (ptr == NULL) {
+        return;
+    }
+    acquire();
+    record('f', ptr, NULL, 0);
+    __libc_free(ptr);
+    release();
+}
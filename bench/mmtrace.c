@@ -0,0 +1,392 @@
+/*
+ * mmtrace.c
+ *
+ * Generates synthetic allocation traces, in the .rep format read by
+ * mmbench, that mimic the heap behaviour of common server workloads.
+ *
+ *     gcc -O2 -o mmtrace bench/mmtrace.c
+ *     ./mmtrace <workload> [ops] [seed] > <workload>.rep
+ *
+ * Workloads:
+ *     kvcache  key-value cache: key, value and entry node per item, values
+ *              replaced in place or reallocated, oldest items evicted
+ *     http     keep-alive connections serving requests: read buffer,
+ *              header strings, a response body grown with realloc, all
+ *              released at the end of the request
+ *     session  long-lived sessions with attributes, short-lived per-request
+ *              scratch objects in between
+ *     json     documents parsed into trees of small nodes and strings,
+ *              arrays grown by doubling, most trees freed in one go
+ *
+ * The same workload, ops and seed always give the same trace.
+ * bench/gentraces.sh generates the benchmark's set.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+typedef struct op {
+    char type;
+    unsigned id;
+    size_t size;
+} op_t;
+
+static op_t *ops;
+static size_t num_ops, max_ops;
+static size_t *id_size;         // current size of every id, 0 when free
+static unsigned num_ids, max_ids;
+static size_t live, peak_live;
+static uint64_t rng_state;
+
+/*
+ * rnd: xorshift64* pseudo-random numbers; rnd_range is uniform in [lo, hi].
+ */
+static uint64_t rnd(void)
+{
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+    return rng_state * 0x2545F4914F6CDD1DULL;
+}
+
+static size_t rnd_range(size_t lo, size_t hi)
+{
+    return lo + rnd() % (hi - lo + 1);
+}
+
+/*
+ * rnd_value_size: a skewed object size: mostly small, rarely several KiB.
+ */
+static size_t rnd_value_size(void)
+{
+    unsigned r = rnd() % 100;
+    if (r < 50) {
+        return rnd_range(8, 64);
+    } else if (r < 80) {
+        return rnd_range(65, 256);
+    } else if (r < 95) {
+        return rnd_range(257, 1024);
+    }
+    return rnd_range(1025, 8192);
+}
+
+static bool full(void)
+{
+    return num_ops >= max_ops;
+}
+
+static void emit(char type, unsigned id, size_t size)
+{
+    if (num_ops < max_ops) {
+        ops[num_ops++] = (op_t){ type, id, size };
+    }
+}
+
+/*
+ * t_alloc/t_realloc/t_free: append an operation and track live bytes.
+ *                           t_alloc returns the new id.
+ */
+static unsigned t_alloc(size_t size)
+{
+    if (num_ids == max_ids) {
+        max_ids = 2 * max_ids + 1024;
+        id_size = realloc(id_size, max_ids * sizeof(size_t));
+    }
+    unsigned id = num_ids++;
+    id_size[id] = size;
+    live += size;
+    peak_live = (live > peak_live) ? live : peak_live;
+    emit('a', id, size);
+    return id;
+}
+
+static void t_realloc(unsigned id, size_t size)
+{
+    live += size - id_size[id];
+    id_size[id] = size;
+    peak_live = (live > peak_live) ? live : peak_live;
+    emit('r', id, size);
+}
+
+static void t_free(unsigned id)
+{
+    live -= id_size[id];
+    id_size[id] = 0;
+    emit('f', id, 0);
+}
+
+/* kvcache: items in random key slots, evicted oldest first */
+#define KV_KEYS 4096
+#define KV_CAPACITY 2500
+
+typedef struct { bool used; unsigned key, value, node; } kv_item_t;
+
+static void gen_kvcache(void)
+{
+    static kv_item_t items[KV_KEYS];
+    static unsigned fifo[KV_KEYS];
+    unsigned head = 0, tail = 0, count = 0;
+
+    while (!full()) {
+        unsigned k = rnd() % KV_KEYS;
+        kv_item_t *item = &items[k];
+        if (item->used) {
+            // Update: small changes stay in place, others get a new buffer
+            if (rnd() % 2) {
+                t_realloc(item->value, rnd_value_size());
+            } else {
+                t_free(item->value);
+                item->value = t_alloc(rnd_value_size());
+            }
+            continue;
+        }
+        if (count == KV_CAPACITY) {
+            kv_item_t *old = &items[fifo[head]];
+            head = (head + 1) % KV_KEYS;
+            if (old->used) {
+                t_free(old->node);
+                t_free(old->key);
+                t_free(old->value);
+                old->used = false;
+                count--;
+            }
+        }
+        item->node = t_alloc(48);
+        item->key = t_alloc(rnd_range(16, 64));
+        item->value = t_alloc(rnd_value_size());
+        item->used = true;
+        fifo[tail] = k;
+        tail = (tail + 1) % KV_KEYS;
+        count++;
+    }
+}
+
+/* http: in-flight requests on keep-alive connections */
+#define HTTP_CONNS 32
+#define HTTP_MAX_OBJS 64
+
+typedef struct {
+    int state;                  // 0 idle, 1 headers read, 2 responding
+    bool open;
+    unsigned conn, rbuf;
+    unsigned objs[HTTP_MAX_OBJS];
+    unsigned nobjs;
+    unsigned body;
+    size_t body_size;
+    int grows;
+} http_conn_t;
+
+static void gen_http(void)
+{
+    static http_conn_t conns[HTTP_CONNS];
+
+    while (!full()) {
+        http_conn_t *c = &conns[rnd() % HTTP_CONNS];
+        if (!c->open) {
+            c->conn = t_alloc(rnd_range(256, 512));
+            c->rbuf = t_alloc(4096);
+            c->open = true;
+            c->state = 0;
+            continue;
+        }
+        switch (c->state) {
+        case 0:
+            // Request line and headers
+            c->nobjs = 0;
+            c->objs[c->nobjs++] = t_alloc(rnd_range(160, 256));
+            for (unsigned n = rnd_range(5, 24); n > 0 && c->nobjs < HTTP_MAX_OBJS; n--) {
+                c->objs[c->nobjs++] = t_alloc(rnd_range(16, 128));
+            }
+            c->state = 1;
+            break;
+        case 1:
+            // Handler: scratch objects, some freed right away
+            for (unsigned n = rnd_range(2, 12); n > 0; n--) {
+                unsigned id = t_alloc(rnd_value_size());
+                if (rnd() % 3 != 0 || c->nobjs == HTTP_MAX_OBJS) {
+                    t_free(id);
+                } else {
+                    c->objs[c->nobjs++] = id;
+                }
+            }
+            c->body_size = 1024;
+            c->body = t_alloc(c->body_size);
+            c->grows = (int)rnd_range(0, 5);
+            c->state = 2;
+            break;
+        default:
+            if (c->grows-- > 0) {
+                c->body_size *= 2;
+                t_realloc(c->body, c->body_size);
+                break;
+            }
+            // Response sent: the request's memory goes back in one burst
+            t_free(c->body);
+            for (unsigned i = 0; i < c->nobjs; i++) {
+                t_free(c->objs[c->nobjs - 1 - i]);
+            }
+            c->state = 0;
+            if (rnd() % 5 == 0) {
+                t_free(c->rbuf);
+                t_free(c->conn);
+                c->open = false;
+            }
+            break;
+        }
+    }
+}
+
+/* session: long-lived sessions, short-lived scratch between them */
+#define SESSIONS 600
+#define SESSION_ATTRS 12
+
+typedef struct {
+    bool used;
+    unsigned obj;
+    unsigned attrs[SESSION_ATTRS];
+    unsigned nattrs;
+} session_t;
+
+static void gen_session(void)
+{
+    static session_t sessions[SESSIONS];
+
+    while (!full()) {
+        session_t *s = &sessions[rnd() % SESSIONS];
+        unsigned r = rnd() % 100;
+        if (!s->used) {
+            s->obj = t_alloc(rnd_range(1024, 2048));
+            s->nattrs = rnd_range(3, 10);
+            for (unsigned i = 0; i < s->nattrs; i++) {
+                s->attrs[i] = t_alloc(rnd_range(32, 256));
+            }
+            s->used = true;
+        } else if (r < 8) {
+            // Logout or expiry
+            for (unsigned i = 0; i < s->nattrs; i++) {
+                t_free(s->attrs[i]);
+            }
+            t_free(s->obj);
+            s->used = false;
+        } else if (r < 20 && s->nattrs < SESSION_ATTRS) {
+            s->attrs[s->nattrs++] = t_alloc(rnd_range(32, 256));
+        } else if (r < 30) {
+            t_realloc(s->attrs[rnd() % s->nattrs], rnd_range(32, 512));
+        } else {
+            // A request touching the session: scratch, freed LIFO
+            unsigned scratch[8];
+            unsigned n = rnd_range(1, 8);
+            for (unsigned i = 0; i < n; i++) {
+                scratch[i] = t_alloc(rnd_value_size());
+            }
+            while (n > 0) {
+                t_free(scratch[--n]);
+            }
+        }
+    }
+}
+
+/* json: parse trees of small nodes; a few documents are cached */
+#define JSON_CACHED 16
+#define JSON_MAX_NODES 4096
+
+typedef struct {
+    unsigned ids[JSON_MAX_NODES];
+    unsigned n;
+} json_doc_t;
+
+static void json_free(json_doc_t *doc)
+{
+    // Trees are torn down in allocation order
+    for (unsigned i = 0; i < doc->n; i++) {
+        t_free(doc->ids[i]);
+    }
+    doc->n = 0;
+}
+
+static void gen_json(void)
+{
+    static json_doc_t cache[JSON_CACHED];
+    static json_doc_t doc;
+
+    while (!full()) {
+        unsigned nodes = rnd_range(50, 1200);
+        doc.n = 0;
+        for (unsigned i = 0; i < nodes && doc.n + 2 < JSON_MAX_NODES; i++) {
+            unsigned r = rnd() % 100;
+            doc.ids[doc.n++] = t_alloc(48);
+            if (r < 60) {
+                doc.ids[doc.n++] = t_alloc(rnd_range(4, 64));
+            } else if (r < 70) {
+                // Array of pointers grown by doubling
+                size_t cap = 4;
+                unsigned arr = t_alloc(cap * sizeof(void *));
+                for (unsigned g = rnd_range(0, 6); g > 0; g--) {
+                    cap *= 2;
+                    t_realloc(arr, cap * sizeof(void *));
+                }
+                doc.ids[doc.n++] = arr;
+            }
+        }
+        if (rnd() % 10 == 0) {
+            json_doc_t *slot = &cache[rnd() % JSON_CACHED];
+            json_free(slot);
+            *slot = doc;
+        } else {
+            json_free(&doc);
+        }
+    }
+}
+
+static const struct {
+    const char *name;
+    void (*gen)(void);
+} workloads[] = {
+    { "kvcache", gen_kvcache },
+    { "http", gen_http },
+    { "session", gen_session },
+    { "json", gen_json },
+};
+
+int main(int argc, char **argv)
+{
+    size_t nworkloads = sizeof(workloads) / sizeof(workloads[0]);
+    size_t w;
+
+    for (w = 0; argc >= 2 && w < nworkloads; w++) {
+        if (strcmp(argv[1], workloads[w].name) == 0) {
+            break;
+        }
+    }
+    if (argc < 2 || w == nworkloads) {
+        fprintf(stderr, "usage: %s kvcache|http|session|json [ops] [seed]\n", argv[0]);
+        return 2;
+    }
+    max_ops = (argc > 2) ? strtoul(argv[2], NULL, 10) : 40000;
+    rng_state = (argc > 3) ? strtoull(argv[3], NULL, 10) : 1;
+    rng_state = rng_state * 0x9E3779B97F4A7C15ULL + 1;
+    ops = malloc(max_ops * sizeof(op_t));
+    if (ops == NULL) {
+        fprintf(stderr, "out of memory\n");
+        return 1;
+    }
+
+    workloads[w].gen();
+
+    // Ids allocated by an operation past the cut-off are never used
+    unsigned used_ids = 0;
+    for (size_t i = 0; i < num_ops; i++) {
+        used_ids = (ops[i].id + 1 > used_ids) ? ops[i].id + 1 : used_ids;
+    }
+    printf("%zu\n%u\n%zu\n1\n", peak_live, used_ids, num_ops);
+    for (size_t i = 0; i < num_ops; i++) {
+        if (ops[i].type == 'f') {
+            printf("f %u\n", ops[i].id);
+        } else {
+            printf("%c %u %zu\n", ops[i].type, ops[i].id, ops[i].size);
+        }
+    }
+    return 0;
+}
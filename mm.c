@@ -4,15 +4,28 @@
  * NOTE TO STUDENTS: Replace this header comment with your own header
  * comment that gives a high level description of your solution.
  */
+#define _GNU_SOURCE             // mremap
 #include <assert.h>
+#include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 #include <stdbool.h>
 #include <stdint.h>
+#include <stdarg.h>
+#include <pthread.h>
+#include <time.h>
+#include <math.h>
+#include <sys/mman.h>
+#include <dlfcn.h>
+#include <execinfo.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 #include "mm.h"
+#include "mm_ext.h"
 #include "memlib.h"
 
 /*
@@ -39,6 +52,297 @@
 #define dbg_printheap(...)
 #endif
 
+/*
+ * Thread cache: every thread keeps a bounded magazine of blocks per small
+ * size class in front of find_fit/place. A magazine hit needs no lock and
+ * no atomic operation; misses refill, and overflows flush, in batches under
+ * the arena lock. Build with -DMM_TCACHE=0 for the plain single-threaded
+ * allocator, which then takes no locks at all.
+ */
+#ifndef MM_TCACHE
+#define MM_TCACHE 1
+#endif
+#ifndef MM_TCACHE_MAX
+#define MM_TCACHE_MAX 512      // largest block size kept in a magazine
+#endif
+#ifndef MM_TCACHE_COUNT
+#define MM_TCACHE_COUNT 32     // magazine capacity per size class
+#endif
+
+/*
+ * Arenas: independent heaps, each with its own segregated lists and its own
+ * sbrk-grown regions. Threads are assigned to arenas round-robin on first
+ * use; a block freed by a thread of another arena is pushed onto the
+ * owner's lock-free remote-free stack and released by the owner later.
+ */
+#ifndef MM_ARENAS
+#if MM_TCACHE
+#define MM_ARENAS 4
+#else
+#define MM_ARENAS 1
+#endif
+#endif
+#if MM_ARENAS > 1 && !MM_TCACHE
+#error "MM_ARENAS > 1 requires the thread-safe build (MM_TCACHE)"
+#endif
+#if MM_ARENAS > 127
+#error "MM_ARENAS must be at most 127"
+#endif
+#ifndef MM_HEAP_MAX
+#define MM_HEAP_MAX ((size_t)1 << 32)  // largest heap; at most 64 GiB
+#endif
+
+/*
+ * Size classes: by default every power of two from 32 bytes up is split
+ * into 1 << MM_CLASS_SUBDIV equal sub-classes, TLSF style; with 64 classes
+ * that covers 64 >> MM_CLASS_SUBDIV powers of two. Alternatively
+ * -DMM_CLASS_BOUNDS=48,64,96,... gives explicit ascending class bounds
+ * (at most 63), e.g. taken from an object-size histogram.
+ */
+#ifndef MM_CLASS_SUBDIV
+#define MM_CLASS_SUBDIV 2
+#endif
+#if MM_CLASS_SUBDIV < 0 || MM_CLASS_SUBDIV > 4
+#error "MM_CLASS_SUBDIV must be between 0 and 4"
+#endif
+
+/*
+ * Placement policy of find_fit, fixed at build time:
+ *   MM_FIT_FIRST    first fit in the class of the request, oldest block
+ *                   first, else any block of the next non-empty class
+ *   MM_FIT_GOOD     TLSF good fit: take a block from the smallest class
+ *                   that is guaranteed to fit; O(1), no list walk
+ *   MM_FIT_BEST     bounded best fit over up to MM_FIT_BEST_K candidates
+ *   MM_FIT_ADDRESS  lists kept in address order, lowest fitting address
+ */
+#define MM_FIT_FIRST   0
+#define MM_FIT_GOOD    1
+#define MM_FIT_BEST    2
+#define MM_FIT_ADDRESS 3
+#ifndef MM_FIT_POLICY
+#define MM_FIT_POLICY MM_FIT_FIRST
+#endif
+#ifndef MM_FIT_BEST_K
+#define MM_FIT_BEST_K 8
+#endif
+
+/*
+ * Blocks of at least MM_MMAP_THRESHOLD bytes get a private anonymous
+ * mapping instead of heap space; free unmaps them at once and realloc
+ * uses mremap. 0 disables the path, which is the default for the driver
+ * since it requires every payload to lie inside the mem_sbrk heap.
+ */
+#ifndef MM_MMAP_THRESHOLD
+#ifdef DRIVER
+#define MM_MMAP_THRESHOLD 0
+#else
+#define MM_MMAP_THRESHOLD (256 * 1024)
+#endif
+#endif
+#if MM_MMAP_THRESHOLD > 0 && MM_MMAP_THRESHOLD <= MM_TCACHE_MAX
+#error "MM_MMAP_THRESHOLD must exceed MM_TCACHE_MAX"
+#endif
+
+/*
+ * Slabs: requests of at most MM_SLAB_MAX bytes are served from runs, one
+ * page each, holding objects of a single 16-byte size class. The run
+ * header keeps the class and a free bitmap, so objects carry no header and
+ * are never coalesced. A run is itself an allocated heap block; runs that
+ * empty out go back to the segregated lists. MM_SLAB=0 disables them.
+ */
+#ifndef MM_SLAB
+#define MM_SLAB 1
+#endif
+#if !MM_SLAB
+#undef MM_SLAB_MAX
+#define MM_SLAB_MAX 0
+#elif !defined(MM_SLAB_MAX)
+#define MM_SLAB_MAX 256
+#endif
+#if MM_SLAB_MAX % 16 != 0 || MM_SLAB_MAX > 1024
+#error "MM_SLAB_MAX must be a multiple of 16 and at most 1024"
+#endif
+#if MM_TCACHE && MM_SLAB_MAX > MM_TCACHE_MAX
+#error "MM_SLAB_MAX must not exceed MM_TCACHE_MAX"
+#endif
+
+/*
+ * Returning memory to the OS. A free block of at least MM_TRIM_THRESHOLD
+ * bytes at the top of the heap is trimmed at once, down to a pad that
+ * follows recent demand (see trim_block); every MM_PURGE_INTERVAL freed
+ * bytes an arena also purges free blocks of at least MM_PURGE_MIN bytes.
+ * Both release whole interior pages with madvise(MADV_DONTNEED); with
+ * -DMM_SBRK_SHRINKS (mem_sbrk accepts negative increments) the trim
+ * shrinks the heap instead. MM_PURGE=0 disables all of it.
+ */
+#ifndef MM_PURGE
+#define MM_PURGE 1
+#endif
+#ifndef MM_TRIM_THRESHOLD
+#define MM_TRIM_THRESHOLD (128 * 1024)
+#endif
+#ifndef MM_PURGE_MIN
+#define MM_PURGE_MIN (64 * 1024)
+#endif
+#ifndef MM_PURGE_INTERVAL
+#define MM_PURGE_INTERVAL (4 * 1024 * 1024)
+#endif
+
+/*
+ * Huge pages: with MM_HUGE=1 every heap growth ends on an MM_HUGE_SIZE
+ * boundary and the new memory is advised MADV_HUGEPAGE, so transparent
+ * huge pages can back the heap; mapped blocks of at least MM_HUGE_SIZE are
+ * aligned to it and advised the same way. Purging and trimming then
+ * release whole huge pages only, so as not to split them.
+ */
+#ifndef MM_HUGE
+#define MM_HUGE 0
+#endif
+#ifndef MM_HUGE_SIZE
+#define MM_HUGE_SIZE (2 * 1024 * 1024)
+#endif
+#if (MM_HUGE_SIZE & (MM_HUGE_SIZE - 1)) != 0 || MM_HUGE_SIZE < 4096
+#error "MM_HUGE_SIZE must be a power of two of at least a page"
+#endif
+
+/*
+ * Compact links: with MM_COMPACT_LINKS=1 the prev/next links of regular
+ * free blocks are 32-bit heap offsets, encoded like those of mini blocks
+ * (see mini_to_offset), instead of pointers, so a block's header and
+ * both links fit in 16 bytes.
+ */
+#ifndef MM_COMPACT_LINKS
+#define MM_COMPACT_LINKS 0
+#endif
+
+/*
+ * Lazy coalescing: with MM_LAZY_COALESCE=1 a freed heap block of at most
+ * MM_LAZY_MAX bytes is not coalesced but parked, still marked allocated,
+ * on its arena's quick list for that exact size, and the next request of
+ * the size takes it back without a split. Blocks are coalesced in bulk: a
+ * whole quick list once it holds MM_LAZY_COUNT blocks, and every list when
+ * find_fit fails or mm_trim runs.
+ */
+#ifndef MM_LAZY_COALESCE
+#define MM_LAZY_COALESCE 0
+#endif
+#ifndef MM_LAZY_MAX
+#define MM_LAZY_MAX 4096       // largest block size parked on a quick list
+#endif
+#ifndef MM_LAZY_COUNT
+#define MM_LAZY_COUNT 64       // quick list length that triggers coalescing
+#endif
+#if MM_LAZY_MAX % 16 != 0 || MM_LAZY_COUNT < 1
+#error "MM_LAZY_MAX must be a multiple of 16 and MM_LAZY_COUNT positive"
+#endif
+
+/*
+ * Background maintenance: with MM_BACKGROUND=1, mm_background_start runs a
+ * thread that, every interval, drains each arena's remote frees,
+ * coalesces its parked blocks and trims and purges its free pages. While
+ * it runs, free coalesces nothing: every freed heap block is parked, on a
+ * quick list however long it grows or, above MM_LAZY_MAX, on the arena's
+ * deferred list, and trimming and purging are left to the thread too; a
+ * malloc that finds no fit still coalesces them all first. The
+ * thread is one more lock holder, not a lock-free reader: it takes one
+ * arena lock at a time and then init_lock, in the usual order, so it only
+ * touches the segregated lists under the same lock as any thread, and
+ * mm_init waits for it.
+ */
+#ifndef MM_BACKGROUND
+#define MM_BACKGROUND 0
+#endif
+#if MM_BACKGROUND && !MM_TCACHE
+#error "MM_BACKGROUND requires the thread-safe build (MM_TCACHE)"
+#endif
+#if MM_BACKGROUND && !MM_LAZY_COALESCE
+#error "MM_BACKGROUND requires lazy coalescing (MM_LAZY_COALESCE)"
+#endif
+
+/*
+ * calloc skips clearing memory that is known to be zero: fresh mappings,
+ * purged pages and, with -DMM_SBRK_ZEROED, memory fresh from mem_sbrk
+ * (not the case for the driver's memlib, which reuses its heap between
+ * traces). Clears of at least MM_NT_THRESHOLD bytes use non-temporal
+ * stores so they do not flush the cache.
+ */
+#ifndef MM_NT_THRESHOLD
+#define MM_NT_THRESHOLD (256 * 1024)
+#endif
+
+/*
+ * Heap growth: when no free block fits, an arena grows the heap by its
+ * growth step or by the request, whichever is larger. The step starts at
+ * chunksize and doubles with every growth up to MM_GROW_MAX, so a burst of
+ * allocations takes a few large mem_sbrk calls instead of many small
+ * ones; it never exceeds a sixteenth of what the arena has grown so far,
+ * which bounds the overshoot on small heaps. It halves again whenever a
+ * free leaves two steps free at the heap top, as the heap is then mostly
+ * free at its end. A step of slack at the top is not trimmed.
+ * -DMM_GROW_MAX=4096 gives the fixed chunksize growth.
+ */
+#ifndef MM_GROW_MAX
+#define MM_GROW_MAX (256 * 1024)
+#endif
+#if MM_GROW_MAX < 4096 || MM_GROW_MAX % 16 != 0
+#error "MM_GROW_MAX must be a multiple of 16 and at least chunksize"
+#endif
+
+/*
+ * Statistics read with mm_stats() (see mm_ext.h): allocations and frees,
+ * magazine traffic, heap growth, coalescing and the free blocks of every
+ * class. Arena counters are updated under the arena lock; the lock-free
+ * paths count per thread and fold their counts into the next arena they
+ * lock. -DMM_STATS=0 compiles every counter out.
+ */
+#ifndef MM_STATS
+#define MM_STATS 1
+#endif
+#if MM_STATS
+#define stat_add(counter, n) ((counter) += (n))
+#define stat_add_atomic(counter, n) \
+    __atomic_fetch_add(&(counter), (n), __ATOMIC_RELAXED)
+#else
+#define stat_add(counter, n) ((void)(n))
+#define stat_add_atomic(counter, n) ((void)(n))
+#endif
+
+/*
+ * mm_frag_run walks the heap in steps of MM_FRAG_STEP blocks, checking its
+ * time budget and releasing the arena locks between steps.
+ */
+#ifndef MM_FRAG_STEP
+#define MM_FRAG_STEP 1024
+#endif
+
+/*
+ * Sampling allocation profiler, driven by mm_profile_start() (see
+ * mm_ext.h). While no profile runs, malloc and free only test a global.
+ * At most MM_PROFILE_SITES call sites and MM_PROFILE_LIVE sampled live
+ * objects are tracked (both powers of two), with MM_PROFILE_DEPTH stack
+ * frames per site. Needs backtrace(), dladdr() and libm (-lm), so the
+ * driver build leaves it out unless asked for.
+ */
+#ifndef MM_PROFILE
+#ifdef DRIVER
+#define MM_PROFILE 0
+#else
+#define MM_PROFILE 1
+#endif
+#endif
+#ifndef MM_PROFILE_SITES
+#define MM_PROFILE_SITES 1024
+#endif
+#ifndef MM_PROFILE_LIVE
+#define MM_PROFILE_LIVE 4096
+#endif
+#ifndef MM_PROFILE_DEPTH
+#define MM_PROFILE_DEPTH 16
+#endif
+#if (MM_PROFILE_SITES & (MM_PROFILE_SITES - 1)) != 0 \
+    || (MM_PROFILE_LIVE & (MM_PROFILE_LIVE - 1)) != 0
+#error "MM_PROFILE_SITES and MM_PROFILE_LIVE must be powers of two"
+#endif
 
 
 /* do not change the following! */
@@ -52,6 +356,15 @@
 #define memcpy mem_memcpy
 #endif /* def DRIVER */
 
+#ifdef DRIVER
+/* The extended entry points are named like the ones above (see mm_ext.h) */
+#define memalign mm_memalign
+#define posix_memalign mm_posix_memalign
+#define aligned_alloc mm_aligned_alloc
+#define free_sized mm_free_sized
+#define malloc_usable_size mm_usable_size
+#endif
+
 
 /* Basic constants */
 typedef uint64_t word_t;
@@ -63,28 +376,55 @@ static const size_t chunksize = (1<<12);    // requires (chunksize % 16 == 0)
 static const word_t alloc_mask = 0x1;
 static const word_t prev_alloc_mask = 0x2;
 static const word_t mini_mask = 0x4;
+#if MM_MMAP_THRESHOLD > 0
+static const word_t mmap_mask = 0x8;  // allocated block has its own mapping
+#endif
+static const word_t purged_mask = 0x8; // free block's interior pages are zero
 static const word_t size_mask = ~(word_t)0xF;
 
 /* What is the correct alignment? */
 #define ALIGNMENT 16
 
+#define PAGE_SHIFT 12
+#define PAGE_SIZE  ((size_t)1 << PAGE_SHIFT)
+
+/* Granularity at which free memory goes back to the OS */
+#if MM_HUGE
+#define RELEASE_SIZE MM_HUGE_SIZE
+#else
+#define RELEASE_SIZE PAGE_SIZE
+#endif
+
 /* rounds up to the nearest multiple of ALIGNMENT */
 static size_t align(size_t x) {
     return ALIGNMENT * ((x+ALIGNMENT-1)/ALIGNMENT);
 }
 
 
+/*
+ * A free mini block has only 8 bytes of payload, so its links are stored as
+ * two 32-bit heap offsets (see mini_to_offset). That keeps the mini list
+ * doubly linked and makes unlinking any mini block O(1).
+ */
 typedef struct block_2 {
     word_t header;
-    struct block_2 *next;
+    uint32_t prev;
+    uint32_t next;
 } block_t_2;
 
+/* A free-list link: a heap offset with MM_COMPACT_LINKS, else a pointer */
+#if MM_COMPACT_LINKS
+typedef uint32_t link_t;
+#else
+typedef struct block *link_t;
+#endif
+
 typedef struct block
 {
     /* Header contains size + allocation flag */
     word_t header;
-    struct block* prev;
-    struct block* next;
+    link_t prev;
+    link_t next;
     /*
      * We don't know how big the payload will be.  Declaring it as an
      * array of size 0 allows computing its starting address using
@@ -97,24 +437,275 @@ typedef struct block
      */
 } block_t;
 
-#define LIST_NUM  7
-static block_t *free_listp_array[LIST_NUM];
-static block_t *free_listp_array_tail[LIST_NUM];
-static block_t_2 *mini_listp;
+/*
+ * Segregated lists, one per size class (see get_number); the last class
+ * takes everything larger. Bit i of an arena's nonempty_lists is set
+ * exactly when class i is non-empty.
+ */
+#define LIST_NUM  64
+_Static_assert(LIST_NUM == MM_STATS_CLASSES, "mm_stats_t has one entry per class");
+#define LIST_MIN_SHIFT 5    // log2 of the smallest regular block (32 bytes)
+
+#ifdef MM_CLASS_BOUNDS
+static const size_t class_bounds[] = { MM_CLASS_BOUNDS };
+#define CLASS_BOUNDS_NUM (sizeof(class_bounds) / sizeof(class_bounds[0]))
+_Static_assert(CLASS_BOUNDS_NUM < LIST_NUM, "too many MM_CLASS_BOUNDS");
+#endif
+
+#if MM_LAZY_COALESCE
+#define QUICK_BINS (MM_LAZY_MAX / ALIGNMENT)
+#endif
+
+#if MM_SLAB
+#define SLAB_BINS (MM_SLAB_MAX / ALIGNMENT)
+#define RUN_HEADER 64
+#define RUN_MAP_WORDS 4
+
+/*
+ * run_t: header of a slab run. A run is a page-aligned page; its objects
+ * of size bytes follow the RUN_HEADER bytes of the header, and bit i of
+ * free_map is set while object i is free. Runs with free objects are on
+ * their arena's list for the class, full runs are on no list.
+ */
+typedef struct run {
+    struct run *prev;
+    struct run *next;
+    uint16_t size;             // object size
+    uint16_t bin;              // slab class, size / 16 - 1
+    uint16_t nobjs;
+    uint16_t nfree;
+    uint64_t free_map[RUN_MAP_WORDS];
+} run_t;
+
+_Static_assert(sizeof(run_t) <= RUN_HEADER, "run header too large");
+_Static_assert((PAGE_SIZE - RUN_HEADER) / ALIGNMENT <= 64 * RUN_MAP_WORDS,
+               "run free map too small");
+#endif
+
+#if MM_STATS
+/*
+ * Allocation counters of one thread or of the mapped blocks. Thread
+ * counters are folded into an arena_stats_t by lock_arena.
+ */
+typedef struct thread_stats {
+    uint64_t allocs;
+    uint64_t alloc_bytes;
+    uint64_t frees;
+    uint64_t freed_bytes;
+    uint64_t tcache_hits;
+    uint64_t remote_frees;
+} thread_stats_t;
+
+/*
+ * Counters of one arena, updated under its lock. free_blocks and
+ * free_bytes describe the segregated lists (class 0 includes the mini
+ * list); class_allocs counts the blocks and slab objects the arena handed
+ * out, magazine refills included.
+ */
+typedef struct arena_stats {
+    thread_stats_t folded;          // counts of the lock-free paths
+    uint64_t tcache_refills;
+    uint64_t tcache_flushes;
+    uint64_t extend_heap;
+    uint64_t extend_heap_bytes;
+    uint64_t extend_heap_overshoot;
+    uint64_t coalesce[4];           // by case, see coalesce
+    uint64_t class_allocs[LIST_NUM];
+    uint64_t free_blocks[LIST_NUM];
+    uint64_t free_bytes;
+    uint64_t slab_runs;
+    uint64_t lazy_hits;
+} arena_stats_t;
+#endif
+
+/*
+ * arena_t: one independent heap. An arena owns one or more contiguous
+ * regions of the sbrk heap. Each region ends in a size-0 header like the
+ * epilogue, which stays in place when another arena's region starts after
+ * it, behind a pad word and an allocated fence block; so coalesce never
+ * crosses an arena boundary and an arena never writes another's header.
+ */
+typedef struct arena {
+    block_t *free_listp_array[LIST_NUM];
+    block_t *free_listp_array_tail[LIST_NUM];
+    uint64_t nonempty_lists;
+    block_t_2 *mini_listp;
+    void *remote_frees;        // payloads freed by threads of other arenas
+    size_t dirty_bytes;        // bytes freed since the last purge pass
+    size_t purged_bytes;       // total released with madvise
+    size_t trimmed_bytes;      // total given back by shrinking the heap
+    char *top_mark;            // furthest allocation out of a region end
+    char *top_clean;           // region-end pages from here up are purged
+    size_t top_keep;           // region-end bytes to keep (see trim_block)
+    size_t grow;               // current heap growth step (see grow_heap)
+    size_t grown;              // bytes the arena has grown the heap by
+#if MM_SLAB
+    run_t *runs[SLAB_BINS];    // runs with free objects, per slab class
+#endif
+#if MM_LAZY_COALESCE
+    block_t *quick[QUICK_BINS]; // freed blocks not yet coalesced, by size
+    unsigned quick_count[QUICK_BINS];
+    block_t *deferred;          // larger ones, parked for the background
+#endif
+    size_t lazy_bytes;         // bytes on the quick lists
+#if MM_STATS
+    arena_stats_t stats;
+#endif
+#if MM_TCACHE
+    pthread_mutex_t lock;
+#endif
+} arena_t;
+
+#if MM_TCACHE
+static arena_t arenas[MM_ARENAS] = {
+    [0 ... MM_ARENAS - 1] = { .lock = PTHREAD_MUTEX_INITIALIZER }
+};
+#else
+static arena_t arenas[MM_ARENAS];
+#endif
 
 /* Global variables */
 /* Pointer to first block */
 static block_t *heap_listp = NULL;
+/* Start of the heap; mini-list offsets are relative to it */
+static char *heap_start = NULL;
+/* Bumped by every mm_init, so that stale magazines can be recognized */
+static unsigned heap_epoch = 0;
+/* Arena whose region currently ends at the epilogue */
+static arena_t *heap_top_arena = NULL;
+/* Next block of the paused fragmentation walk, and the walk's owner */
+static block_t *frag_cursor = NULL;
+static const mm_frag_t *frag_walker = NULL;
+
+#define PAGE_MAP (MM_ARENAS > 1 || MM_SLAB)
+#if PAGE_MAP
+/*
+ * One byte per heap page, indexed from the page of mem_heap_lo(): the
+ * owning arena, plus PAGE_RUN while the page is a slab run. Entries below
+ * page_map_top have been written since the last mm_init.
+ */
+#define PAGE_RUN   0x80
+#define PAGE_ARENA 0x7F
+static unsigned char page_map[MM_HEAP_MAX >> PAGE_SHIFT];
+static size_t page_map_top = 0;
+static uintptr_t heap_base_page;
+#endif
+#if MM_ARENAS > 1
+static unsigned next_arena = 0;
+static __thread arena_t *thread_arena;
+#endif
+#if MM_STATS
+static __thread thread_stats_t thread_stats;
+/* Mapped blocks are not covered by any lock; updated atomically */
+static thread_stats_t mmap_stats;
+#endif
+
+#if MM_PROFILE
+/* A call site seen by the profiler: its stack and the samples taken there */
+typedef struct prof_site {
+    uint64_t hash;                  // of the frames; 0 while the slot is unused
+    void *frames[MM_PROFILE_DEPTH]; // innermost first
+    int depth;
+    uint64_t samples;
+    uint64_t bytes;                 // estimated bytes allocated here
+    uint64_t live_bytes;            // share of bytes not freed yet
+    uint64_t frees;
+    uint64_t lifetime_ns;           // summed over the freed samples
+} prof_site_t;
+
+/* A sampled object that has not been freed yet */
+typedef struct prof_live {
+    void *bp;                       // NULL: unused, PROF_DELETED: removed
+    prof_site_t *site;
+    uint64_t bytes;
+    uint64_t start_ns;
+    int number;                     // size class, see get_number
+} prof_live_t;
+
+#define PROF_DELETED ((void *)1)
+
+/*
+ * State of the profiler, guarded by prof_lock. rate and nlive are also
+ * read without the lock by malloc and free, and live by free: entries are
+ * never moved within a table; removing one leaves PROF_DELETED behind and
+ * compaction copies into the other table of prof_tables.
+ */
+typedef struct profile {
+    size_t rate;                    // mean bytes between samples; 0: off
+    size_t nlive;
+    size_t nused;                   // live and deleted entries in live
+    prof_live_t *live;
+    uint64_t samples;
+    uint64_t dropped;               // samples without a site or live slot
+    uint64_t class_samples[LIST_NUM];
+    uint64_t class_bytes[LIST_NUM];
+    uint64_t class_frees[LIST_NUM];
+    uint64_t class_lifetime_ns[LIST_NUM];
+    prof_site_t sites[MM_PROFILE_SITES];
+} profile_t;
+
+static profile_t prof;
+static prof_live_t prof_tables[2][MM_PROFILE_LIVE];
+static pthread_mutex_t prof_lock = PTHREAD_MUTEX_INITIALIZER;
+static __thread int64_t prof_countdown;  // bytes until the next sample
+static __thread uint64_t prof_rng;
+static __thread bool prof_busy;          // inside backtrace
+#endif
+
+#if MM_TCACHE
+#define TCACHE_BINS (MM_TCACHE_MAX / ALIGNMENT)
+
+/*
+ * Per-thread magazines of payload pointers. Bin i holds slab objects of
+ * (i+1)*16 bytes up to MM_SLAB_MAX, and blocks of exactly (i+1)*16 bytes
+ * beyond it. Both are still marked allocated in their run or on the heap,
+ * so the segregated lists and coalesce never see them. Slots are used as a
+ * stack: the most recently freed (cache-hot) one is handed out first.
+ */
+typedef struct tcache {
+    unsigned epoch;           // heap_epoch the cached blocks belong to
+    bool registered;          // thread-exit flush has been set up
+    unsigned count[TCACHE_BINS];
+    void *slots[TCACHE_BINS][MM_TCACHE_COUNT];
+} tcache_t;
+
+static __thread tcache_t tcache;
+/*
+ * Protects mem_sbrk and heap_top_arena; taken after an arena lock. The
+ * header ending a region, epilogue or not, is only ever written by the
+ * region's arena under its own lock; no other arena touches it.
+ */
+static pthread_mutex_t sbrk_lock = PTHREAD_MUTEX_INITIALIZER;
+/* Serializes (lazy) heap initialization; taken before sbrk_lock */
+static pthread_mutex_t init_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t tcache_key;
+static pthread_once_t tcache_key_once = PTHREAD_ONCE_INIT;
+#endif
+
+#if MM_BACKGROUND
+/* Serializes mm_background_start and mm_background_stop */
+static pthread_mutex_t bg_control = PTHREAD_MUTEX_INITIALIZER;
+/* Guards bg_stop; the thread sleeps on bg_wake */
+static pthread_mutex_t bg_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t bg_wake = PTHREAD_COND_INITIALIZER;
+static pthread_t bg_thread;
+static bool bg_running;         // read by note_free and quick_push unlocked
+static bool bg_stop;
+static uint64_t bg_interval_ns;
+#endif
+
 /* Function prototypes for internal helper routines */
-static block_t *extend_heap(size_t size);
-static void place(block_t *block, size_t asize);
-static block_t *find_fit(size_t asize);
-static block_t *coalesce(block_t *block);
+static block_t *extend_heap(arena_t *arena, size_t size, block_t *end);
+static block_t *grow_heap(arena_t *arena, size_t need, block_t *end);
+static void place(arena_t *arena, block_t *block, size_t asize);
+static block_t *find_fit(arena_t *arena, size_t asize);
+static block_t *coalesce(arena_t *arena, block_t *block);
 
 static size_t max(size_t x, size_t y);
 static size_t round_up(size_t size, size_t n);
 static word_t pack(size_t size, bool alloc, bool prev_alloc, bool mini);
 
+static word_t load_header(block_t *block);
 static size_t extract_size(word_t header);
 static size_t get_size(block_t *block);
 static size_t get_payload_size(block_t *block);
@@ -136,17 +727,123 @@ static block_t *find_prev(block_t *block);
 
 bool mm_checkheap(int lineno);
 
-static void remove_free_block(block_t* pointer);
-static void insert_free_block(block_t* pointer);
-static void insert_free_block_mini(block_t_2* pointer);
+static void remove_free_block(arena_t *arena, block_t* pointer);
+static void insert_free_block(arena_t *arena, block_t* pointer);
+static void insert_free_block_mini(arena_t *arena, block_t_2* pointer);
 static int explict_list_check(int lineno, int explict_list_check);
 static int get_number(size_t size);
 static void *header_to_payload_mini(block_t_2 *block);
 static bool get_prev_mini(block_t *block);
 static bool extract_prev_mini(word_t word);
-static void remove_mini_free_block(block_t_2 *pointer);
+static void remove_mini_free_block(arena_t *arena, block_t_2 *pointer);
+static uint32_t mini_to_offset(block_t_2 *block);
+static block_t_2 *offset_to_mini(uint32_t offset);
+static link_t to_link(block_t *block);
+static block_t *from_link(link_t link);
 // static bool is_curr_min(block_t *block);
 
+static bool init_heap(void);
+static size_t adjust_size(size_t size);
+static void *malloc_block(arena_t *arena, size_t asize);
+static void *malloc_aligned(size_t alignment, size_t size);
+static block_t *find_block(arena_t *arena, size_t asize);
+static void purge_span(block_t *block, char **lo, char **hi);
+static void zero_fill(void *p, size_t n);
+static void free_block(arena_t *arena, block_t *block);
+#if MM_LAZY_COALESCE
+static bool quick_push(arena_t *arena, block_t *block);
+static block_t *quick_pop(arena_t *arena, size_t asize);
+static void quick_flush(arena_t *arena, size_t bin);
+static bool quick_flush_all(arena_t *arena);
+#endif
+static void release_payload(void *bp);
+static void free_payload(arena_t *arena, void *bp);
+static size_t carve_batch(arena_t *arena, size_t asize, size_t n, void **out);
+static void free_run(arena_t *arena, void **ptrs, size_t n);
+static void sort_addresses(void **ptrs, size_t n);
+static void sift_down(void **ptrs, size_t root, size_t n);
+static size_t usable_size(void *bp);
+static block_t *alloc_aligned(arena_t *arena, size_t alignment, size_t asize);
+static block_t *place_aligned(arena_t *arena, block_t *block, size_t slack, size_t asize);
+static bool resize_block(arena_t *arena, block_t *block, size_t asize);
+#if MM_PURGE
+static void note_free(arena_t *arena, block_t *block, size_t size);
+static size_t trim_block(arena_t *arena, block_t *block);
+static size_t purge_block(arena_t *arena, block_t *block);
+static size_t purge_arena(arena_t *arena, size_t min_size);
+#endif
+static void mark_top(arena_t *arena, block_t *block, block_t *block_next);
+#if MM_MMAP_THRESHOLD > 0
+static bool get_mmapped(block_t *block);
+static void *mmap_block(size_t alignment, size_t asize);
+static char *map_start(block_t *block);
+static void munmap_block(block_t *block);
+static void *mremap_block(block_t *block, size_t asize);
+#endif
+static arena_t *get_arena(void);
+static arena_t *arena_of(const void *p);
+static void map_arena(arena_t *arena, const void *lo, const void *hi);
+static void push_remote(arena_t *arena, void *bp);
+static void drain_remote(arena_t *arena);
+#if MM_BACKGROUND
+static void *bg_main(void *arg);
+static void bg_tick(void);
+#endif
+static void *count_alloc(void *bp, size_t size);
+static void count_free(void *bp, size_t size);
+static void profile_alloc(void *bp, size_t size);
+static void profile_free(void *bp);
+#if MM_PROFILE
+static int64_t prof_gap(size_t rate);
+static void profile_sample(void *bp, size_t size, size_t rate);
+static void profile_release(void *bp);
+static prof_live_t *prof_find(prof_live_t *table, void *bp);
+static prof_site_t *prof_site(void **frames, int depth);
+static uint64_t prof_now(void);
+static size_t frame_name(void *pc, char *buf, size_t size);
+#endif
+#if MM_STATS
+static void fold_stats(arena_t *arena);
+#endif
+static size_t class_min_size(int number);
+static size_t json_printf(char *buf, size_t size, size_t n, const char *fmt, ...);
+static size_t json_array(char *buf, size_t size, size_t n, const char *name,
+                         const uint64_t *values, int count);
+#if MM_SLAB
+static size_t slab_bin(size_t size);
+static run_t *run_of(const void *bp);
+static bool is_slab(const void *bp);
+static void *slab_alloc(arena_t *arena, size_t bin);
+static void slab_free(arena_t *arena, void *bp);
+static run_t *new_run(arena_t *arena, size_t bin);
+static void link_run(arena_t *arena, run_t *run);
+static void unlink_run(arena_t *arena, run_t *run);
+#endif
+static void lock_arena(arena_t *arena);
+static void unlock_arena(arena_t *arena);
+static void lock_sbrk(void);
+static void unlock_sbrk(void);
+static void lock_init(void);
+static void unlock_init(void);
+static void lock_arenas(void);
+static void unlock_arenas(void);
+static void merge_boundary(block_t *gone);
+static void frag_visit(mm_frag_t *frag, block_t *block, size_t size);
+static void set_prev_bits(block_t *block, bool prev_alloc, bool prev_mini);
+static bool is_epilogue(block_t *block);
+
+#if MM_TCACHE
+static void *tcache_pop(size_t bin);
+static void *tcache_alloc(arena_t *arena, size_t bin);
+static void *tcache_refill(size_t bin);
+static void tcache_push(void *bp, size_t bin);
+static void tcache_flush(tcache_t *tc, size_t bin, unsigned n);
+static void tcache_check_epoch(tcache_t *tc);
+static void tcache_register(tcache_t *tc);
+static void tcache_key_init(void);
+static void tcache_destroy(void *arg);
+#endif
+
 
 /*
  * mm_init: initializes the heap; it is run once when heap_start == NULL.
@@ -156,6 +853,21 @@ static void remove_mini_free_block(block_t_2 *pointer);
  * heap_listp ends up pointing to the epilogue header.
  */
 bool mm_init(void) 
+{
+    lock_init();
+    bool ok = init_heap();
+    unlock_init();
+    return ok;
+}
+
+/*
+ * init_heap: body of mm_init; the caller holds init_lock. Every arena is
+ *            emptied and the first region is given to arenas[0]. Blocks
+ *            still sitting in thread magazines belong to the previous heap
+ *            and are dropped lazily once their thread sees the new
+ *            heap_epoch.
+ */
+static bool init_heap(void)
 {
     // Create the initial empty heap 
     word_t *start = (word_t *)(mem_sbrk(2*wsize));
@@ -167,21 +879,59 @@ bool mm_init(void)
     
     start[0] = pack(0, true, true, false); // Prologue footer
     start[1] = pack(0, true, true, false); // Epilogue header
-    // Heap starts with first block header (epilogue)
-    heap_listp = (block_t *) &(start[1]);
-
-    for (int i = 0; i < LIST_NUM; i++) {
-        free_listp_array[i] = NULL;
-        free_listp_array_tail[i] = NULL;
+    heap_start = (char *)start;
+    heap_epoch++;
+
+    for (int a = 0; a < MM_ARENAS; a++) {
+        arena_t *arena = &arenas[a];
+        for (int i = 0; i < LIST_NUM; i++) {
+            arena->free_listp_array[i] = NULL;
+            arena->free_listp_array_tail[i] = NULL;
+        }
+        arena->nonempty_lists = 0;
+        arena->mini_listp = NULL;
+        arena->remote_frees = NULL;
+        arena->dirty_bytes = 0;
+        arena->purged_bytes = 0;
+        arena->trimmed_bytes = 0;
+        arena->top_mark = NULL;
+        arena->top_clean = NULL;
+        arena->top_keep = 0;
+        arena->grow = chunksize;
+        arena->grown = 0;
+#if MM_SLAB
+        for (int i = 0; i < SLAB_BINS; i++) {
+            arena->runs[i] = NULL;
+        }
+#endif
+#if MM_LAZY_COALESCE
+        memset(arena->quick, 0, sizeof(arena->quick));
+        memset(arena->quick_count, 0, sizeof(arena->quick_count));
+        arena->deferred = NULL;
+#endif
+        arena->lazy_bytes = 0;
+#if MM_STATS
+        memset(&arena->stats, 0, sizeof(arena->stats));
+#endif
     }
+#if MM_STATS
+    memset(&thread_stats, 0, sizeof(thread_stats));
+    memset(&mmap_stats, 0, sizeof(mmap_stats));
+#endif
+    heap_top_arena = &arenas[0];
+#if PAGE_MAP
+    heap_base_page = (uintptr_t)mem_heap_lo() >> PAGE_SHIFT;
+    memset(page_map, 0, page_map_top);
+    page_map_top = 0;
+#endif
 
-    mini_listp = NULL;
-
-    block_t* mm_init_block = extend_heap(chunksize);
+    block_t* mm_init_block = extend_heap(&arenas[0], chunksize, NULL);
     if (mm_init_block == NULL)
     {
         return false;
     }
+    // Heap starts with first block header; publish it last
+    __atomic_store_n(&heap_listp, (block_t *) &(start[1]), __ATOMIC_RELEASE);
     dbg_printf("mm_init_block: %p\n", mm_init_block);
     dbg_printf("mm_init's pointer's header: %lu\n", mm_init_block->header);
     return true;
@@ -192,478 +942,3116 @@ bool mm_init(void)
  *         the nearest 16 bytes, with a minimum of 2*dsize. Seeks a
  *         sufficiently-large unallocated block on the heap to be allocated.
  *         If no such block is found, extends heap by the maximum between
- *         chunksize and (size + dsize) rounded up to the nearest 16 bytes,
- *         and then attempts to allocate all, or a part of, that memory.
+ *         the arena's growth step (see grow_heap) and (size + dsize)
+ *         rounded up to the nearest 16 bytes, and then attempts to allocate all, or a part of, that memory.
  *         Returns NULL on failure, otherwise returns a pointer to such block.
  *         The allocated block will not be used for further allocations until
- *         freed.
+ *         freed. Requests of at most MM_SLAB_MAX bytes get an object of a
+ *         slab run instead of a block. Small objects and blocks come from
+ *         the thread's magazine when possible, everything else from the
+ *         thread's arena.
  */
 void *malloc(size_t size) 
 {
-    // heap_printer(213);
     dbg_printf("Start Malloc Size:  %ld\n", size);
-    // heap_printer(__LINE__);
-    dbg_requires(mm_checkheap);
-    size_t asize;      // Adjusted block size
-    size_t extendsize; // Amount to extend heap if no fit is found
-    block_t *block;
     void *bp = NULL;
 
-    if (heap_listp == NULL) // Initialize heap if it isn't initialized
-    {
-        mm_init();
-    }
-    // printf("input size: %lu\n", size);
     if (size == 0) // Ignore spurious request
     {
-        dbg_ensures(mm_checkheap);
         return bp;
     }
-    // Adjust block size to include overhead and to meet alignment requirements
-    if (size <= wsize)
+
+#if MM_SLAB
+    if (size <= MM_SLAB_MAX)
     {
-        asize = dsize;
+        size_t bin = slab_bin(size);
+#if MM_TCACHE
+        bp = tcache_pop(bin);
+        if (bp == NULL)
+        {
+            bp = tcache_refill(bin);
+        }
+#else
+        arena_t *arena = get_arena();
+        lock_arena(arena);
+        bp = slab_alloc(arena, bin);
+        unlock_arena(arena);
+#endif
+        return count_alloc(bp, (bin + 1) * ALIGNMENT);
     }
-    else
+#endif
+    size_t asize = adjust_size(size);
+
+#if MM_MMAP_THRESHOLD > 0
+    if (asize >= MM_MMAP_THRESHOLD)
     {
-        asize = round_up((size + wsize), dsize);
+        return mmap_block(ALIGNMENT, asize);
     }
+#endif
 
-    // Search the free list for a fit
-    block = find_fit(asize);
-
-    // If no fit is found, request more memory, and then and place the block
-    if (block == NULL)
+#if MM_TCACHE
+    if (asize <= MM_TCACHE_MAX)
     {
-        extendsize = max(asize, chunksize);
-        block = extend_heap(extendsize);
-        if (block == NULL) // extend_heap returns an error
+        bp = tcache_pop(asize / dsize - 1);
+        if (bp == NULL)
         {
-            return bp;
+            bp = tcache_refill(asize / dsize - 1);
         }
-
+        return count_alloc(bp, asize);
     }
+#endif
 
-    place(block, asize);
-    bp = header_to_payload(block);
-
-    dbg_ensures(mm_checkheap);
-    return bp;
+    arena_t *arena = get_arena();
+    lock_arena(arena);
+    bp = malloc_block(arena, asize);
+    unlock_arena(arena);
+    return count_alloc(bp, asize);
 } 
 
 /*
- * free: Frees the block such that it is no longer allocated while still
- *       maintaining its size. Block will be available for use on malloc.
+ * adjust_size: block size serving a request of size bytes: payload plus
+ *              header, rounded up to 16 bytes, and at least a mini block.
  */
-void free(void *bp)
+static size_t adjust_size(size_t size)
 {
-    // heap_printer(319);
-    dbg_printf("FREE: address: %p\n", bp);
-    if (bp == NULL)
+    if (size <= wsize)
     {
-        return;
+        return dsize;
     }
+    return round_up((size + wsize), dsize);
+}
 
-    block_t *block = payload_to_header(bp);
-    size_t size = get_size(block);
+/*
+ * malloc_block: the shared-heap half of malloc; the caller holds the arena
+ *               lock. Finds or creates a free block of asize bytes in the
+ *               arena and places it.
+ */
+static void *malloc_block(arena_t *arena, size_t asize)
+{
+    dbg_requires(mm_checkheap);
+#if MM_LAZY_COALESCE
+    block_t *block = quick_pop(arena, asize);
 
-    bool prev_alloc = get_prev_alloc(block);
-    bool prev_mini = get_prev_mini(block);
-    write_header(block, size, false, prev_alloc, prev_mini);
-    if (size > dsize) {
-        write_footer(block, size, false, prev_alloc, prev_mini);
+    if (block != NULL)
+    {
+        stat_add(arena->stats.lazy_hits, 1);
+        stat_add(arena->stats.class_allocs[get_number(asize)], 1);
+        return header_to_payload(block);
     }
-    block_t *block_next = find_next(block);
-    bool mini_curr;
-    if (size <= dsize) {
-        mini_curr = true;
-    } else {
-        mini_curr = false;
+    block = find_block(arena, asize);
+#else
+    block_t *block = find_block(arena, asize);
+#endif
+
+    if (block == NULL)
+    {
+        return NULL;
     }
-    write_header(block_next, get_size(block_next), get_alloc(block_next), false, mini_curr);
-    coalesce(block);
+    place(arena, block, asize);
+    stat_add(arena->stats.class_allocs[get_number(asize)], 1);
+
+    dbg_ensures(mm_checkheap);
+    return header_to_payload(block);
 }
+
 /*
- * realloc: returns a pointer to an allocated region of at least size bytes:
- *          if ptrv is NULL, then call malloc(size);
- *          if size == 0, then call free(ptr) and returns NULL;
- *          else allocates new region of memory, copies old data to new memory,
- *          and then free old block. Returns old block if realloc fails or
- *          returns new pointer on success.
+ * alloc_aligned: allocates a block of asize bytes whose payload is aligned
+ *                to alignment, a power of two of at least 16. The caller
+ *                holds the arena lock. Returns NULL on failure.
  */
-void *realloc(void *ptr, size_t size)
+static block_t *alloc_aligned(arena_t *arena, size_t alignment, size_t asize)
 {
-    block_t *block = payload_to_header(ptr);
-    size_t copysize;
-    void *newptr;
+    // Any free block this large holds an aligned payload of asize bytes
+    block_t *block = find_block(arena, asize + alignment);
 
-    // If size == 0, then free block and return NULL
-    if (size == 0)
+    if (block == NULL)
     {
-        free(ptr);
         return NULL;
     }
+    uintptr_t bp = (uintptr_t)header_to_payload(block);
+    return place_aligned(arena, block, round_up(bp, alignment) - bp, asize);
+}
 
-    // If ptr is NULL, then equivalent to malloc
-    if (ptr == NULL)
+/*
+ * find_block: returns a free block of at least asize bytes from the arena,
+ *             extending the heap if no fit is found, or NULL on failure.
+ *             The caller holds the arena lock.
+ */
+static block_t *find_block(arena_t *arena, size_t asize)
+{
+    block_t *block;
+
+    if (__atomic_load_n(&heap_listp, __ATOMIC_ACQUIRE) == NULL)
     {
-        return malloc(size);
+        // Initialize heap if it isn't initialized
+        lock_init();
+        if (heap_listp == NULL)
+        {
+            init_heap();
+        }
+        unlock_init();
     }
+    drain_remote(arena);
 
-    // Otherwise, proceed with reallocation
-    newptr = malloc(size);
-    // If malloc fails, the original block is left untouched
-    if (!newptr)
+    // Search the free list for a fit
+    block = find_fit(arena, asize);
+#if MM_LAZY_COALESCE
+    // Parked blocks may coalesce into a fit
+    if (block == NULL && quick_flush_all(arena))
     {
-        return NULL;
+        block = find_fit(arena, asize);
     }
+#endif
 
-    // Copy the old data
-    copysize = get_payload_size(block); // gets size of old payload
-    if(size < copysize)
+    // If no fit is found, request more memory, and then and place the block
+    if (block == NULL)
     {
-        copysize = size;
+        block = grow_heap(arena, asize, NULL);
     }
-    memcpy(newptr, ptr, copysize);
-
-    // Free the old block
-    free(ptr);
-
-    return newptr;
+    return block;
 }
 
 /*
- * calloc: Allocates a block with size at least (elements * size + dsize)
- *         through malloc, then initializes all bits in allocated memory to 0.
- *         Returns NULL on failure.
+ * free: Frees the block such that it is no longer allocated while still
+ *       maintaining its size. Block will be available for use on malloc.
+ *       Small objects and blocks go back to the thread's magazine first.
  */
-void *calloc(size_t nmemb, size_t size)
+void free(void *bp)
 {
-    void *bp;
-    size_t asize = nmemb * size;
-
-    if (asize/nmemb != size)
-    // Multiplication overflowed
-    return NULL;
-    
-    bp = malloc(asize);
+    dbg_printf("FREE: address: %p\n", bp);
     if (bp == NULL)
     {
-        return NULL;
+        return;
     }
-    // Initialize all bits to 0
-    memset(bp, 0, asize);
 
-    return bp;
+#if MM_SLAB
+    // Slab objects have no header; only the page map knows them
+    if (is_slab(bp))
+    {
+        count_free(bp, run_of(bp)->size);
+#if MM_TCACHE
+        tcache_push(bp, run_of(bp)->bin);
+#else
+        release_payload(bp);
+#endif
+        return;
+    }
+#endif
+
+    block_t *block = payload_to_header(bp);
+
+#if MM_MMAP_THRESHOLD > 0
+    if (get_mmapped(block))
+    {
+        munmap_block(block);
+        return;
+    }
+#endif
+
+    size_t size = get_size(block);
+    count_free(bp, size);
+#if MM_TCACHE
+    // Blocks no larger than MM_SLAB_MAX are never requested; do not cache them
+    if (size > MM_SLAB_MAX && size <= MM_TCACHE_MAX)
+    {
+        tcache_push(bp, size / dsize - 1);
+        return;
+    }
+#endif
+
+    release_payload(bp);
 }
 
-/******** The remaining content below are helper and debug routines ********/
+/*
+ * free_sized: free for callers that know the size they asked malloc,
+ *             calloc or realloc for. A size of at most MM_SLAB_MAX always
+ *             names a slab object of bin slab_bin(size) (realloc keeps it
+ *             that way), so those objects skip the page map and the run
+ *             header. Larger blocks still read their header, as placement
+ *             may have left them bigger than adjust_size(size). Debug
+ *             builds check the size against the object.
+ */
+void free_sized(void *bp, size_t size)
+{
+    if (bp == NULL)
+    {
+        return;
+    }
+#if MM_SLAB
+    if (size <= MM_SLAB_MAX)
+    {
+        size_t bin = slab_bin(size);
+        dbg_assert(is_slab(bp) && run_of(bp)->bin == bin);
+        count_free(bp, (bin + 1) * ALIGNMENT);
+#if MM_TCACHE
+        tcache_push(bp, bin);
+#else
+        release_payload(bp);
+#endif
+        return;
+    }
+#else
+    (void)size;
+#endif
+    dbg_assert(usable_size(bp) >= size);
+    free(bp);
+}
 
 /*
- * extend_heap: Extends the heap with the requested number of bytes, and
- *              recreates epilogue header. Returns a pointer to the result of
- *              coalescing the newly-created block with previous free block, if
- *              applicable, or NULL in failure.
-     void *high_payload = mem_heap_hi();
+ * release_payload: returns an allocated block or slab object to its owning
+ *                  arena, directly if that is the calling thread's arena
+ *                  and through the owner's remote-free stack otherwise.
  */
-static block_t *extend_heap(size_t size) 
+static void release_payload(void *bp)
 {
-    void *bp;
+    arena_t *arena = arena_of(bp);
 
-    // Allocate an even number of words to maintain alignment
-    size = round_up(size, dsize);
-    if ((bp = mem_sbrk(size)) == (void *)-1)
+    if (arena != get_arena())
     {
-        return NULL;
+        push_remote(arena, bp);
+        return;
     }
-    // Initialize free block header/footer 
-    block_t *block = payload_to_header(bp);
+    lock_arena(arena);
+    free_payload(arena, bp);
+    unlock_arena(arena);
+}
+
+/*
+ * free_payload: frees a slab object or heap block of the arena, whose lock
+ *               the caller holds.
+ */
+static void free_payload(arena_t *arena, void *bp)
+{
+#if MM_SLAB
+    if (is_slab(bp))
+    {
+        slab_free(arena, bp);
+        return;
+    }
+#endif
+#if MM_LAZY_COALESCE
+    if (quick_push(arena, payload_to_header(bp))) {
+        return;
+    }
+#endif
+    free_block(arena, payload_to_header(bp));
+}
+
+/*
+ * free_block: the shared-heap half of free; the caller holds the lock of
+ *             the arena owning the block. Marks the block free and coalesces
+ *             it into the arena's segregated lists.
+ */
+static void free_block(arena_t *arena, block_t *block)
+{
+    size_t size = get_size(block);
 
     bool prev_alloc = get_prev_alloc(block);
     bool prev_mini = get_prev_mini(block);
     write_header(block, size, false, prev_alloc, prev_mini);
-    write_footer(block, size, false, prev_alloc, prev_mini);
-    // Create new epilogue header
-
+    if (size > dsize) {
+        write_footer(block, size, false, prev_alloc, prev_mini);
+    }
     block_t *block_next = find_next(block);
-    write_header(block_next, 0, true, false, false);
-    // Coalesce in case the previous block was free
-    return coalesce(block);
+    bool mini_curr;
+    if (size <= dsize) {
+        mini_curr = true;
+    } else {
+        mini_curr = false;
+    }
+    set_prev_bits(block_next, false, mini_curr);
+    block = coalesce(arena, block);
+    if (get_size(block) >= 2 * arena->grow && get_size(find_next(block)) == 0) {
+        // The heap top is mostly free: grow by less next time
+        arena->grow = max(arena->grow / 2, chunksize);
+    }
+#if MM_PURGE
+    note_free(arena, block, size);
+#endif
+}
+
+#if MM_LAZY_COALESCE
+/*
+ * quick_push: parks a freed block on the arena's quick list for its size,
+ *             unless it is larger than MM_LAZY_MAX; returns whether it did.
+ *             The header keeps the block allocated, so no neighbour
+ *             coalesces with it, and the first payload word links the
+ *             list. A full list is coalesced first. While the background
+ *             thread runs, lists are never full and larger blocks go on
+ *             the deferred list: the thread coalesces them all.
+ */
+static bool quick_push(arena_t *arena, block_t *block)
+{
+    size_t size = get_size(block);
+#if MM_BACKGROUND
+    bool deferring = __atomic_load_n(&bg_running, __ATOMIC_RELAXED);
+#else
+    bool deferring = false;
+#endif
+
+    if (size > MM_LAZY_MAX) {
+        if (!deferring) {
+            return false;
+        }
+        *(block_t **)header_to_payload(block) = arena->deferred;
+        arena->deferred = block;
+        arena->lazy_bytes += size;
+        return true;
+    }
+    size_t bin = size / dsize - 1;
+    if (arena->quick_count[bin] >= MM_LAZY_COUNT && !deferring) {
+        quick_flush(arena, bin);
+    }
+    *(block_t **)header_to_payload(block) = arena->quick[bin];
+    arena->quick[bin] = block;
+    arena->quick_count[bin]++;
+    arena->lazy_bytes += size;
+    return true;
 }
 
+/*
+ * quick_pop: takes a parked block of exactly asize bytes, or returns NULL.
+ *            The block is still allocated and needs no place.
+ */
+static block_t *quick_pop(arena_t *arena, size_t asize)
+{
+    if (asize > MM_LAZY_MAX) {
+        return NULL;
+    }
+    size_t bin = asize / dsize - 1;
+    block_t *block = arena->quick[bin];
+    if (block != NULL) {
+        arena->quick[bin] = *(block_t **)header_to_payload(block);
+        arena->quick_count[bin]--;
+        arena->lazy_bytes -= asize;
+    }
+    return block;
+}
 
-/* Coalesce: Coalesces current block with previous and next blocks if either
- *           or both are unallocated; otherwise the block is not modified.
- *           Returns pointer to the coalesced block. After coalescing, the
- *           immediate contiguous previous and next blocks must be allocated.
+/*
+ * quick_flush: frees and coalesces every block on quick list bin.
  */
-static block_t *coalesce(block_t *block) 
+static void quick_flush(arena_t *arena, size_t bin)
 {
-    bool prev_mini = get_prev_mini(block);
-    block_t *block_next = find_next(block);
+    block_t *block = arena->quick[bin];
+
+    arena->lazy_bytes -= arena->quick_count[bin] * (bin + 1) * dsize;
+    arena->quick[bin] = NULL;
+    arena->quick_count[bin] = 0;
+    while (block != NULL) {
+        block_t *next = *(block_t **)header_to_payload(block);
+        free_block(arena, block);
+        block = next;
+    }
+}
 
-    // bool prev_alloc = extract_alloc(*(find_prev_footer(block)));
-    bool prev_alloc = get_prev_alloc(block);
-    bool next_alloc = get_alloc(block_next);
-    size_t size = get_size(block);
+/*
+ * quick_flush_all: empties every quick list of the arena and its deferred
+ *                  list; returns false if they were all empty already.
+ */
+static bool quick_flush_all(arena_t *arena)
+{
+    if (arena->lazy_bytes == 0) {
+        return false;
+    }
+    block_t *block = arena->deferred;
+    arena->deferred = NULL;
+    while (block != NULL) {
+        block_t *next = *(block_t **)header_to_payload(block);
+        arena->lazy_bytes -= get_size(block);
+        free_block(arena, block);
+        block = next;
+    }
+    for (size_t bin = 0; bin < QUICK_BINS; bin++) {
+        if (arena->quick_count[bin] != 0) {
+            quick_flush(arena, bin);
+        }
+    }
+    return true;
+}
+#endif
 
-    if (prev_alloc && next_alloc)              // Case 1
+/*
+ * mm_malloc_batch: allocates n objects of size bytes each into out, under
+ *                  a single lock of the thread's arena. Blocks are carved
+ *                  back to back from one free block, which costs one list
+ *                  removal and one insertion of the remainder for the
+ *                  whole batch. Small sizes take slab objects, from the
+ *                  thread's magazine first, and large ones get their own
+ *                  mappings. Returns
+ *                  the number of objects allocated, less than n only when
+ *                  memory runs out.
+ */
+size_t mm_malloc_batch(size_t size, size_t n, void **out)
+{
+    size_t got = 0;
+
+    if (size == 0 || size >= MM_HEAP_MAX)
     {
-        if (size == dsize) {
-            block_t_2 *block_mini = (block_t_2 *)block;
-            insert_free_block_mini(block_mini);
-        } else {
-            insert_free_block(block);
+        return 0;
+    }
+    size_t asize = adjust_size(size);
+#if MM_MMAP_THRESHOLD > 0
+    if (size > MM_SLAB_MAX && asize >= MM_MMAP_THRESHOLD)
+    {
+        while (got < n && (out[got] = mmap_block(ALIGNMENT, asize)) != NULL)
+        {
+            got++;
         }
-        return block;
+        return got;
     }
+#endif
 
-    else if (prev_alloc && !next_alloc)        // Case 2
+    arena_t *arena = get_arena();
+#if MM_SLAB
+    if (size <= MM_SLAB_MAX)
     {
-        size += get_size(block_next);
+        size_t bin = slab_bin(size);
+#if MM_TCACHE
+        // Empty the magazine first, then take the rest from the arena
+        while (got < n && (out[got] = tcache_pop(bin)) != NULL)
+        {
+            got++;
+        }
+#endif
+        lock_arena(arena);
+        while (got < n && (out[got] = slab_alloc(arena, bin)) != NULL)
+        {
+            got++;
+        }
+        unlock_arena(arena);
+        asize = (bin + 1) * ALIGNMENT;
+    }
+    else
+#endif
+    {
+        lock_arena(arena);
+        got = carve_batch(arena, asize, n, out);
+        unlock_arena(arena);
+    }
+    for (size_t i = 0; i < got; i++)
+    {
+        count_alloc(out[i], asize);
+    }
+    return got;
+}
 
-        if (get_size(block_next) == dsize) {
-            block_t_2 *block_min = (block_t_2 *) block_next;
-            remove_mini_free_block(block_min);
-        } else {
-            remove_free_block(block_next);
+/*
+ * carve_batch: allocates up to n blocks of asize bytes into out; the caller
+ *              holds the arena lock. Each round places one block of k * asize
+ *              bytes, where k is what is still missing, and splits it into k
+ *              allocated blocks by writing their headers. When no such block
+ *              can be found or made, k is halved. Returns the number of
+ *              blocks allocated.
+ */
+static size_t carve_batch(arena_t *arena, size_t asize, size_t n, void **out)
+{
+    size_t got = 0;
+    size_t k = n;
+
+    while (got < n && k > 0)
+    {
+        k = (k < n - got) ? k : n - got;
+        k = (k < MM_HEAP_MAX / asize) ? k : MM_HEAP_MAX / asize;
+        block_t *block = find_block(arena, k * asize);
+        if (block == NULL)
+        {
+            k /= 2;
+            continue;
         }
+        // place splits off any remainder, so the block is exactly k * asize
+        place(arena, block, k * asize);
+        bool prev_mini = get_prev_mini(block);
+        for (size_t i = 0; i < k; i++)
+        {
+            write_header(block, asize, true, true, (i == 0) ? prev_mini : asize == dsize);
+            out[got++] = header_to_payload(block);
+            block = find_next(block);
+        }
+        if (asize == dsize && k > 1)
+        {
+            // The successor saw one large block; its predecessor is now mini
+            set_prev_bits(block, true, true);
+        }
+        stat_add(arena->stats.class_allocs[get_number(asize)], k);
+    }
+    return got;
+}
 
-        write_header(block, size, false, prev_alloc, prev_mini);
-        write_footer(block, size, false, prev_alloc, prev_mini);
-        block_t *block_next_2 = find_next(block);
-        write_header(block_next_2, get_size(block_next_2), true, false, false);
+/*
+ * mm_free_batch: frees the n pointers of ptrs, NULL entries included. Slab
+ *                objects go to the thread's magazine and mapped blocks are
+ *                unmapped right away. The heap blocks are gathered at the
+ *                front of ptrs and sorted by address, then freed under a
+ *                single lock of the thread's arena. Runs of adjacent blocks
+ *                are merged first, so that each run takes one coalesce and
+ *                one list insertion. Blocks of other arenas go back as
+ *                remote frees.
+ */
+void mm_free_batch(void **ptrs, size_t n)
+{
+    size_t m = 0;   // heap blocks gathered at the front of ptrs
+
+    for (size_t i = 0; i < n; i++)
+    {
+        void *bp = ptrs[i];
+        if (bp == NULL)
+        {
+            continue;
+        }
+#if MM_SLAB
+        if (is_slab(bp))
+        {
+            count_free(bp, run_of(bp)->size);
+#if MM_TCACHE
+            tcache_push(bp, run_of(bp)->bin);
+#else
+            release_payload(bp);
+#endif
+            continue;
+        }
+#endif
+#if MM_MMAP_THRESHOLD > 0
+        if (get_mmapped(payload_to_header(bp)))
+        {
+            munmap_block(payload_to_header(bp));
+            continue;
+        }
+#endif
+        ptrs[m++] = bp;
     }
+    if (m == 0)
+    {
+        return;
+    }
+    sort_addresses(ptrs, m);
 
-    else if (!prev_alloc && next_alloc)        // Case 3
+    arena_t *arena = get_arena();
+    lock_arena(arena);
+    for (size_t i = 0; i < m; i++)
     {
-        block_t *block_prev = find_prev(block);
-        size += get_size(block_prev);
-        bool prev_prev_alloc = get_prev_alloc(block_prev);
-        bool prev_prev_mini = get_prev_mini(block_prev);
-        
-        remove_free_block(block_prev);
-        write_header(block_prev, size, false, prev_prev_alloc, prev_prev_mini);
-        write_footer(block_prev, size, false, prev_prev_alloc, prev_prev_mini);
+        block_t *block = payload_to_header(ptrs[i]);
+        arena_t *owner = arena_of(ptrs[i]);
+        if (owner != arena)
+        {
+            count_free(ptrs[i], get_size(block));
+            push_remote(owner, ptrs[i]);
+            continue;
+        }
+        // Extend the run while the next pointer is the very next block
+        size_t len = 1;
+        while (i + len < m && ptrs[i + len] == header_to_payload(find_next(block)))
+        {
+            block = find_next(block);
+            len++;
+        }
+        free_run(arena, &ptrs[i], len);
+        i += len - 1;
+    }
+    unlock_arena(arena);
+}
+
+/*
+ * free_run: frees len adjacent allocated blocks, given by their payloads in
+ *           address order, as one block; the caller holds the arena lock.
+ *           Adjacent blocks always share a region, so they share an arena.
+ */
+static void free_run(arena_t *arena, void **ptrs, size_t len)
+{
+    block_t *first = payload_to_header(ptrs[0]);
+    size_t size = 0;
+
+    for (size_t i = 0; i < len; i++)
+    {
+        block_t *block = payload_to_header(ptrs[i]);
+        count_free(ptrs[i], get_size(block));
+        if (i > 0)
+        {
+            merge_boundary(block);
+        }
+        size += get_size(block);
+    }
+    write_header(first, size, true, get_prev_alloc(first), get_prev_mini(first));
+    free_block(arena, first);
+}
+
+/*
+ * sort_addresses: sorts ptrs by address in place, with heapsort, so that
+ *                 neither memory nor another allocator's qsort is needed.
+ */
+static void sort_addresses(void **ptrs, size_t n)
+{
+    // Build a max-heap, then move its top behind it n - 1 times
+    for (size_t i = n / 2; i-- > 0;)
+    {
+        sift_down(ptrs, i, n);
+    }
+    for (size_t end = n; end > 1; end--)
+    {
+        void *top = ptrs[0];
+        ptrs[0] = ptrs[end - 1];
+        ptrs[end - 1] = top;
+        sift_down(ptrs, 0, end - 1);
+    }
+}
+
+/*
+ * sift_down: moves ptrs[root] down the max-heap of the first n entries
+ *            until it is no smaller than its children.
+ */
+static void sift_down(void **ptrs, size_t root, size_t n)
+{
+    size_t child;
+
+    while ((child = 2 * root + 1) < n)
+    {
+        if (child + 1 < n && (uintptr_t)ptrs[child] < (uintptr_t)ptrs[child + 1])
+        {
+            child++;
+        }
+        if ((uintptr_t)ptrs[root] >= (uintptr_t)ptrs[child])
+        {
+            return;
+        }
+        void *tmp = ptrs[root];
+        ptrs[root] = ptrs[child];
+        ptrs[child] = tmp;
+        root = child;
+    }
+}
+
+/*
+ * realloc: returns a pointer to an allocated region of at least size bytes:
+ *          if ptrv is NULL, then call malloc(size);
+ *          if size == 0, then call free(ptr) and returns NULL;
+ *          else resizes the block in place if possible: a shrink splits off
+ *          and frees the tail, a grow absorbs a free successor or extends
+ *          the heap when the block is last. Only otherwise allocates new
+ *          region of memory, copies old data to new memory, and then free
+ *          old block. Sizes of at most MM_SLAB_MAX always end up in a
+ *          slab object of their own bin, as with malloc. Returns NULL if
+ *          realloc fails, leaving the old block untouched, or returns the
+ *          (possibly unchanged) pointer on success.
+ */
+void *realloc(void *ptr, size_t size)
+{
+    block_t *block = payload_to_header(ptr);
+    size_t copysize;
+    void *newptr;
+
+    // If size == 0, then free block and return NULL
+    if (size == 0)
+    {
+        free(ptr);
+        return NULL;
+    }
+
+    // If ptr is NULL, then equivalent to malloc
+    if (ptr == NULL)
+    {
+        return malloc(size);
+    }
+
+#if MM_SLAB
+    if (is_slab(ptr))
+    {
+        // Slab objects never change size; keep the object while its bin
+        // stays the same, so that free_sized can trust the size
+        if (size <= MM_SLAB_MAX && slab_bin(size) == run_of(ptr)->bin)
+        {
+            return ptr;
+        }
+        goto copy;
+    }
+#endif
+
+#if MM_MMAP_THRESHOLD > 0
+    if (get_mmapped(block) && adjust_size(size) >= MM_MMAP_THRESHOLD)
+    {
+        return mremap_block(block, adjust_size(size));
+    }
+    if (get_mmapped(block))
+    {
+        goto copy;
+    }
+#endif
+
+#if MM_SLAB
+    // Small sizes move to a slab object, where malloc would have put them
+    if (size <= MM_SLAB_MAX)
+    {
+        goto copy;
+    }
+#endif
+
+    // Try to resize in place, under the lock of the owning arena
+    arena_t *arena = arena_of(ptr);
+    lock_arena(arena);
+    size_t oldsize = get_size(block);
+    bool resized = resize_block(arena, block, adjust_size(size));
+    size_t newsize = get_size(block);
+    unlock_arena(arena);
+    if (resized)
+    {
+        count_free(ptr, oldsize);
+        count_alloc(ptr, newsize);
+        return ptr;
+    }
+
+#if MM_MMAP_THRESHOLD > 0 || MM_SLAB
+copy:
+#endif
+    // Otherwise, proceed with reallocation
+    newptr = malloc(size);
+    // If malloc fails, the original block is left untouched
+    if (!newptr)
+    {
+        return NULL;
+    }
+
+    // Copy the old data
+    copysize = usable_size(ptr); // gets size of old payload
+    if(size < copysize)
+    {
+        copysize = size;
+    }
+    memcpy(newptr, ptr, copysize);
+
+    // Free the old block
+    free(ptr);
+
+    return newptr;
+}
+
+/*
+ * usable_size: the number of bytes usable at the payload bp: the object
+ *              size of a slab object, else the payload of its block.
+ */
+static size_t usable_size(void *bp)
+{
+#if MM_SLAB
+    if (is_slab(bp))
+    {
+        return run_of(bp)->size;
+    }
+#endif
+    return get_payload_size(payload_to_header(bp));
+}
+
+/*
+ * malloc_usable_size: the number of bytes usable at bp, at least the size
+ *                     it was allocated with; 0 for NULL. The slack may be
+ *                     used freely; realloc preserves it like the rest.
+ */
+size_t malloc_usable_size(void *bp)
+{
+    if (bp == NULL)
+    {
+        return 0;
+    }
+    return usable_size(bp);
+}
+
+/*
+ * resize_block: resizes an allocated block to asize bytes without moving
+ *               it; the caller holds the lock of the owning arena. Growing
+ *               absorbs the next block if it is free, extending the heap
+ *               first if the block is the last one and the arena owns
+ *               the heap top. Surplus of at least a mini block is split
+ *               off and freed. Returns false if the block cannot grow in
+ *               place.
+ */
+static bool resize_block(arena_t *arena, block_t *block, size_t asize)
+{
+    size_t csize = get_size(block);
+
+    if (asize > csize)
+    {
+        block_t *block_next = find_next(block);
+        if (get_size(block_next) == 0)
+        {
+            // Last block of its region: grow the heap behind it, if that
+            // region ends at the heap top
+            if (grow_heap(arena, asize - csize, block_next) == NULL)
+            {
+                return false;
+            }
+        }
+        if (get_alloc(block_next) || csize + get_size(block_next) < asize)
+        {
+            return false;
+        }
+
+        remove_free_block(arena, block_next);
+        merge_boundary(block_next);
+        csize += get_size(block_next);
+        write_header(block, csize, true, get_prev_alloc(block), get_prev_mini(block));
+        block_next = find_next(block);
+        set_prev_bits(block_next, true, false);
+        mark_top(arena, (block_t *)((char *)block + asize), block_next);
+    }
+
+    if (csize - asize >= dsize)
+    {
+        // Split off the surplus and free it like any other block
+        write_header(block, asize, true, get_prev_alloc(block), get_prev_mini(block));
+        block_t *block_rest = find_next(block);
+        write_header(block_rest, csize - asize, true, true, asize == dsize);
+        free_block(arena, block_rest);
+    }
+    return true;
+}
+
+/*
+ * calloc: Allocates a block with size at least (elements * size + dsize)
+ *         through malloc, then initializes all bits in allocated memory to 0.
+ *         Parts of the block known to be zero already (purged or fresh
+ *         pages, new mappings) are not cleared again. Returns NULL on
+ *         failure.
+ */
+void *calloc(size_t nmemb, size_t size)
+{
+    void *bp;
+    size_t asize = nmemb * size;
+
+    if (nmemb != 0 && asize/nmemb != size)
+    // Multiplication overflowed
+    return NULL;
+
+    if (asize == 0 || adjust_size(asize) <= MM_TCACHE_MAX)
+    {
+        bp = malloc(asize);
+        if (bp != NULL)
+        {
+            memset(bp, 0, asize);
+        }
+        return bp;
+    }
+    size_t bsize = adjust_size(asize);
+
+#if MM_MMAP_THRESHOLD > 0
+    if (bsize >= MM_MMAP_THRESHOLD)
+    {
+        // Fresh anonymous mappings are zero-filled by the kernel
+        return mmap_block(ALIGNMENT, bsize);
+    }
+#endif
+
+    char *zero_lo = NULL;
+    char *zero_hi = NULL;
+    arena_t *arena = get_arena();
+    lock_arena(arena);
+    block_t *block = find_block(arena, bsize);
+    if (block != NULL)
+    {
+        if (block->header & purged_mask)
+        {
+            purge_span(block, &zero_lo, &zero_hi);
+        }
+        place(arena, block, bsize);
+        stat_add(arena->stats.class_allocs[get_number(bsize)], 1);
+    }
+    unlock_arena(arena);
+    if (block == NULL)
+    {
+        return NULL;
+    }
+    bp = count_alloc(header_to_payload(block), bsize);
+
+    // Initialize all bits to 0, except for the span known to be zero
+    char *end = (char *)bp + asize;
+    zero_lo = (zero_lo < (char *)bp) ? (char *)bp : zero_lo;
+    zero_hi = (zero_hi > end) ? end : zero_hi;
+    if (zero_lo < zero_hi)
+    {
+        zero_fill(bp, zero_lo - (char *)bp);
+        zero_fill(zero_hi, end - zero_hi);
+    }
+    else
+    {
+        zero_fill(bp, asize);
+    }
+    return bp;
+}
+
+/*
+ * memalign: allocates size bytes aligned to alignment, which is rounded up
+ *           to a power of two. Blocks are carved aligned out of the free
+ *           lists (alloc_aligned) or mapped on their own, and are released
+ *           with free like any other.
+ */
+void *memalign(size_t alignment, size_t size)
+{
+    if (alignment > ((size_t)1 << 62))
+    {
+        return NULL;
+    }
+    if ((alignment & (alignment - 1)) != 0)
+    {
+        alignment = (size_t)1 << (64 - __builtin_clzl(alignment));
+    }
+    return malloc_aligned(alignment, size);
+}
+
+/*
+ * posix_memalign: stores a block of size bytes aligned to alignment, a
+ *                 power of two multiple of sizeof(void *), in *memptr.
+ *                 Returns 0, EINVAL for a bad alignment or ENOMEM.
+ */
+int posix_memalign(void **memptr, size_t alignment, size_t size)
+{
+    if (alignment < sizeof(void *) || (alignment & (alignment - 1)) != 0)
+    {
+        return EINVAL;
+    }
+    void *bp = malloc_aligned(alignment, size);
+    if (bp == NULL && size != 0)
+    {
+        return ENOMEM;
+    }
+    *memptr = bp;
+    return 0;
+}
+
+/*
+ * aligned_alloc: C11 aligned allocation; alignment must be a power of two.
+ */
+void *aligned_alloc(size_t alignment, size_t size)
+{
+    if (alignment == 0 || (alignment & (alignment - 1)) != 0)
+    {
+        errno = EINVAL;
+        return NULL;
+    }
+    return malloc_aligned(alignment, size);
+}
+
+/*
+ * malloc_aligned: the shared body of the aligned entry points, for a power
+ *                 of two alignment. Up to 16 bytes it is plain malloc.
+ *                 Otherwise the slack in front of the aligned block goes
+ *                 back to the free lists as a block of its own, so the
+ *                 over-allocation costs no memory.
+ */
+static void *malloc_aligned(size_t alignment, size_t size)
+{
+    if (alignment <= ALIGNMENT)
+    {
+        return malloc(size);
+    }
+    if (size == 0 || size >= MM_HEAP_MAX || alignment >= MM_HEAP_MAX)
+    {
+        return NULL;
+    }
+    size_t asize = adjust_size(size);
+
+#if MM_MMAP_THRESHOLD > 0
+    if (asize >= MM_MMAP_THRESHOLD)
+    {
+        return mmap_block(alignment, asize);
+    }
+#endif
+
+    arena_t *arena = get_arena();
+    lock_arena(arena);
+    block_t *block = alloc_aligned(arena, alignment, asize);
+    if (block != NULL)
+    {
+        stat_add(arena->stats.class_allocs[get_number(asize)], 1);
+    }
+    unlock_arena(arena);
+    if (block == NULL)
+    {
+        return NULL;
+    }
+    return count_alloc(header_to_payload(block), asize);
+}
+
+/*
+ * zero_fill: clears n bytes at a 16-byte aligned p. Large clears stream
+ *            16-byte non-temporal stores past the cache.
+ */
+static void zero_fill(void *p, size_t n)
+{
+#ifdef __SSE2__
+    if (n >= MM_NT_THRESHOLD)
+    {
+        __m128i zero = _mm_setzero_si128();
+        __m128i *q = (__m128i *)p;
+        size_t i;
+        for (i = 0; i + 4 <= n / 16; i += 4)
+        {
+            _mm_stream_si128(q + i, zero);
+            _mm_stream_si128(q + i + 1, zero);
+            _mm_stream_si128(q + i + 2, zero);
+            _mm_stream_si128(q + i + 3, zero);
+        }
+        _mm_sfence();
+        p = q + i;
+        n -= i * 16;
+    }
+#endif
+    memset(p, 0, n);
+}
+
+/******** The remaining content below are helper and debug routines ********/
+
+/*
+ * extend_heap: Extends the heap with the requested number of bytes, and
+ *              recreates epilogue header. Returns a pointer to the result of
+ *              coalescing the newly-created block with previous free block, if
+ *              applicable, or NULL in failure. The new memory belongs to
+ *              arena; if the heap top is another arena's region, a new,
+ *              page-aligned region starts after that region's epilogue,
+ *              which is left untouched for its own arena. Given end, the
+ *              size-0 header ending one of arena's regions, the new memory
+ *              must continue that region: unless end is the epilogue, it
+ *              fails without growing.
+ */
+static block_t *extend_heap(arena_t *arena, size_t size, block_t *end) 
+{
+    void *bp;
+    size_t fence = 0;   // bytes a new region costs on top of size
+
+    // Allocate an even number of words to maintain alignment
+    size = round_up(size, dsize);
+    lock_sbrk();
+    if (end != NULL && !is_epilogue(end))
+    {
+        // An older region of the arena, or a newer one of another is on top
+        unlock_sbrk();
+        return NULL;
+    }
+#if MM_ARENAS > 1
+    if (heap_top_arena != arena)
+    {
+        // Another arena owns the heap top: start a new region on a fresh
+        // page. Its epilogue stays, so the new region needs a header word
+        // of its own, plus a pad word for alignment and an allocated fence
+        // block covering the rest of the gap
+        uintptr_t first = (uintptr_t)mem_heap_hi() + 1 + wsize;
+        fence = dsize + round_up(first + 3*wsize, PAGE_SIZE) - wsize - first;
+    }
+#endif
+#if MM_HUGE
+    // Grow up to a huge page boundary, so the next growth starts a fresh one
+    uintptr_t heap_end = (uintptr_t)mem_heap_hi() + 1;
+    size_t huge_size = round_up(heap_end + fence + size, MM_HUGE_SIZE) - heap_end - fence;
+    if (mem_heapsize() + fence + huge_size <= MM_HEAP_MAX)
+    {
+        size = huge_size;
+    }
+#endif
+    if (mem_heapsize() + fence + size > MM_HEAP_MAX)
+    {
+        unlock_sbrk();
+        return NULL;
+    }
+    if ((bp = mem_sbrk(fence + size)) == (void *)-1)
+    {
+        unlock_sbrk();
+        return NULL;
+    }
+#if MM_HUGE
+    // The page holding the old heap end was advised by the previous growth
+    uintptr_t advise = round_up(heap_end, PAGE_SIZE);
+    if (heap_end + fence + size > advise)
+    {
+        madvise((void *)advise, heap_end + fence + size - advise, MADV_HUGEPAGE);
+    }
+#endif
+    // Initialize free block header/footer 
+    block_t *block = payload_to_header(bp);
+    bool prev_alloc;
+    bool prev_mini;
+
+    if (fence > 0)
+    {
+        // The fence follows the old epilogue, which reads as allocated
+        block = (block_t *)((char *)bp + wsize);
+        write_header(block, fence - dsize, true, true, false);
+        block = find_next(block);
+        prev_alloc = true;
+        prev_mini = (fence - dsize == dsize);
+    }
+    else
+    {
+        prev_alloc = get_prev_alloc(block);
+        prev_mini = get_prev_mini(block);
+    }
+    write_header(block, size, false, prev_alloc, prev_mini);
+    write_footer(block, size, false, prev_alloc, prev_mini);
+    // Create new epilogue header
+
+    block_t *block_next = find_next(block);
+    write_header(block_next, 0, true, false, false);
+    map_arena(arena, header_to_payload(block), block_next);
+    heap_top_arena = arena;
+    unlock_sbrk();
+    stat_add(arena->stats.extend_heap, 1);
+    stat_add(arena->stats.extend_heap_bytes, fence + size);
+    arena->grown += fence + size;
+    // Coalesce in case the previous block was free
+    block_t *block_free = coalesce(arena, block);
+    if (arena->top_clean < (char *)block_free || arena->top_clean > (char *)block)
+    {
+        // The new pages are untouched, so trim_block need not purge them
+        arena->top_clean = header_to_payload(block);
+    }
+#ifdef MM_SBRK_ZEROED
+    if (block_free == block)
+    {
+        // Untouched memory from mem_sbrk reads as zero, like purged pages
+        block->header |= purged_mask;
+    }
+#endif
+    return block_free;
+}
+
+/*
+ * grow_heap: extends the arena's heap for a request of need bytes by at
+ *            least the arena's growth step, then doubles the step, up to
+ *            MM_GROW_MAX. end and the result are as for extend_heap.
+ *            The overshoot counts every byte extend_heap added beyond need,
+ *            fence and huge page rounding included.
+ */
+static block_t *grow_heap(arena_t *arena, size_t need, block_t *end)
+{
+    // Overshoot at most a sixteenth of what the arena has grown so far
+    size_t step = (arena->grow < arena->grown / 16) ? arena->grow : arena->grown / 16;
+    size_t size = max(need, max(step, chunksize));
+    size_t grown = arena->grown;
+    block_t *block = extend_heap(arena, size, end);
+
+    if (block != NULL)
+    {
+        stat_add(arena->stats.extend_heap_overshoot, arena->grown - grown - need);
+        arena->grow = (arena->grow < MM_GROW_MAX / 2) ? arena->grow * 2 : MM_GROW_MAX;
+    }
+    return block;
+}
+
+/* Coalesce: Coalesces current block with previous and next blocks if either
+ *           or both are unallocated; otherwise the block is not modified.
+ *           Returns pointer to the coalesced block. After coalescing, the
+ *           immediate contiguous previous and next blocks must be allocated.
+ */
+static block_t *coalesce(arena_t *arena, block_t *block) 
+{
+    bool prev_mini = get_prev_mini(block);
+    block_t *block_next = find_next(block);
+
+    // bool prev_alloc = extract_alloc(*(find_prev_footer(block)));
+    bool prev_alloc = get_prev_alloc(block);
+    bool next_alloc = get_alloc(block_next);
+    size_t size = get_size(block);
+
+    if (prev_alloc && next_alloc)              // Case 1
+    {
+        stat_add(arena->stats.coalesce[0], 1);
+        if (size == dsize) {
+            block_t_2 *block_mini = (block_t_2 *)block;
+            insert_free_block_mini(arena, block_mini);
+        } else {
+            insert_free_block(arena, block);
+        }
+        return block;
+    }
+
+    else if (prev_alloc && !next_alloc)        // Case 2
+    {
+        stat_add(arena->stats.coalesce[1], 1);
+        size += get_size(block_next);
+        merge_boundary(block_next);
+
+        if (get_size(block_next) == dsize) {
+            block_t_2 *block_min = (block_t_2 *) block_next;
+            remove_mini_free_block(arena, block_min);
+        } else {
+            remove_free_block(arena, block_next);
+        }
+
+        write_header(block, size, false, prev_alloc, prev_mini);
+        write_footer(block, size, false, prev_alloc, prev_mini);
+        block_t *block_next_2 = find_next(block);
+        set_prev_bits(block_next_2, false, false);
+    }
+
+    else if (!prev_alloc && next_alloc)        // Case 3
+    {
+        stat_add(arena->stats.coalesce[2], 1);
+        block_t *block_prev = find_prev(block);
+        size += get_size(block_prev);
+        merge_boundary(block);
+        bool prev_prev_alloc = get_prev_alloc(block_prev);
+        bool prev_prev_mini = get_prev_mini(block_prev);
+        
+        remove_free_block(arena, block_prev);
+        write_header(block_prev, size, false, prev_prev_alloc, prev_prev_mini);
+        write_footer(block_prev, size, false, prev_prev_alloc, prev_prev_mini);
+
+        set_prev_bits(block_next, false, false);
+
+        block = block_prev;
+    }
+
+    else                                     // Case 4
+    {
+        stat_add(arena->stats.coalesce[3], 1);
+        block_t *block_prev_2 = find_prev(block);
+        size += get_size(block_next) + get_size(block_prev_2);
+        merge_boundary(block);
+        merge_boundary(block_next);
+
+        bool prev_prev_alloc = get_prev_alloc(block_prev_2);
+        bool prev_prev_mini = get_prev_mini(block_prev_2);
+
+        remove_free_block(arena, block_prev_2);
+        remove_free_block(arena, block_next);
+
+        write_header(block_prev_2, size, false, prev_prev_alloc, prev_prev_mini);
+        write_footer(block_prev_2, size, false, prev_prev_alloc, prev_prev_mini);
+
+        block_t *block_next_update = find_next(block_prev_2);
+        set_prev_bits(block_next_update, false, false);
+        block = block_prev_2;
+    }
+    insert_free_block(arena, block);
+    return block;
+}
+
+/*
+ * place: Places block with size of asize at the start of bp. If the remaining
+ *        size is at least the minimum block size, then split the block to the
+ *        the allocated block and the remaining block as free, which is then
+ *        inserted into the segregated list. Requires that the block is
+ *        initially unallocated.
+ */
+static void place(arena_t *arena, block_t *block, size_t asize)
+{
+    size_t csize = get_size(block);
+
+    remove_free_block(arena, block);
+    bool prev_mini = get_prev_mini(block);
+
+    write_header(block, asize, true, true, prev_mini);
+    block_t *block_next = find_next(block);
+
+    if ((csize - asize) == dsize) {
+        if (asize == dsize) {
+            write_header(block_next, dsize, false, true, true);
+
+        } else {
+            write_header(block_next, dsize, false, true, false);
+            write_footer(block_next, dsize, false, true, false);
+        }
+
+        mark_top(arena, block_next, find_next(block_next));
+        set_prev_bits(find_next(block_next), false, true);
+
+        block_t_2 *block_mini = (block_t_2 *) block_next;
+        insert_free_block_mini(arena, block_mini);
+        return;
+    }
+    else if ((csize - asize) > dsize) {
+        if (asize == dsize) {
+            write_header(block_next, csize-asize, false, true, true);
+            write_footer(block_next, csize-asize, false, true, true);
+        } else {
+            write_header(block_next, csize-asize, false, true, false);
+            write_footer(block_next, csize-asize, false, true, false);
+        }
+
+        mark_top(arena, block_next, find_next(block_next));
+        set_prev_bits(find_next(block_next), false, false);
+
+        insert_free_block(arena, block_next);
+        return;
+    }
+    else { 
+        mark_top(arena, block_next, block_next);
+        set_prev_bits(block_next, true, csize == dsize);
+    }
+}
+
+/*
+ * place_aligned: like place, but first splits the leading slack bytes off
+ *                the free block as a free block of their own, so that the
+ *                allocated block starts slack bytes in. slack is 0 or at
+ *                least a mini block. Returns the allocated block.
+ */
+static block_t *place_aligned(arena_t *arena, block_t *block, size_t slack, size_t asize)
+{
+    if (slack == 0) {
+        place(arena, block, asize);
+        return block;
+    }
+    size_t csize = get_size(block);
+    bool prev_mini = get_prev_mini(block);
+
+    remove_free_block(arena, block);
+    write_header(block, slack, false, true, prev_mini);
+    write_footer(block, slack, false, true, prev_mini);
+    block_t *block_aligned = find_next(block);
+    write_header(block_aligned, csize - slack, false, false, slack == dsize);
+    write_footer(block_aligned, csize - slack, false, false, slack == dsize);
+
+    if (slack == dsize) {
+        insert_free_block_mini(arena, (block_t_2 *)block);
+    } else {
+        insert_free_block(arena, block);
+    }
+    insert_free_block(arena, block_aligned);
+    place(arena, block_aligned, asize);
+    // place assumes an allocated predecessor; the slack block is free
+    write_header(block_aligned, asize, true, false, slack == dsize);
+    return block_aligned;
+}
+
+/*
+ * get_number: returns the segregated list class of a block size. By default
+ *             the power of two below size picks a group of sub-classes and
+ *             the next MM_CLASS_SUBDIV bits of size pick one within it;
+ *             with MM_CLASS_BOUNDS it is the number of bounds <= size.
+ */
+static int get_number(size_t size) {
+    if (size < ((size_t)1 << LIST_MIN_SHIFT)) {
+        return 0;
+    }
+#ifdef MM_CLASS_BOUNDS
+    size_t lo = 0;
+    size_t hi = CLASS_BOUNDS_NUM;
+    while (lo < hi) {
+        size_t mid = (lo + hi) / 2;
+        if (size < class_bounds[mid]) {
+            hi = mid;
+        } else {
+            lo = mid + 1;
+        }
+    }
+    return (int)lo;
+#else
+    int log2 = 63 - __builtin_clzl(size);
+    int sub = (int)(size >> (log2 - MM_CLASS_SUBDIV)) & ((1 << MM_CLASS_SUBDIV) - 1);
+    int number = ((log2 - LIST_MIN_SHIFT) << MM_CLASS_SUBDIV) + sub;
+
+    return (number < LIST_NUM) ? number : LIST_NUM - 1;
+#endif
+}
+
+/*
+ * find_fit: Looks for a free block with at least asize bytes, following
+ *           MM_FIT_POLICY. Only the class of asize itself can hold blocks
+ *           that are too small; any block of a larger class fits, and the
+ *           nonempty_lists bitmap names the smallest such class without
+ *           walking any list. Returns NULL if none is found.
+ */
+static block_t *find_fit(arena_t *arena, size_t asize)
+{
+    if (asize == dsize) {
+        if (arena->mini_listp != NULL) {
+            return (block_t *) arena->mini_listp;
+        }
+    }
+    block_t *block;
+    int i = get_number(asize);
+    uint64_t larger = arena->nonempty_lists & (~(uint64_t)1 << i);
+
+#if MM_FIT_POLICY == MM_FIT_GOOD
+    // Prefer a guaranteed fit; the own class is only the last resort
+    if (larger != 0) {
+        return arena->free_listp_array_tail[__builtin_ctzl(larger)];
+    }
+#endif
+
+#if MM_FIT_POLICY == MM_FIT_BEST
+    block_t *best = NULL;
+    int seen = 0;
+    for (block = arena->free_listp_array_tail[i]; block != NULL && seen < MM_FIT_BEST_K; block = from_link(block->prev)) {
+        size_t size = get_size(block);
+        if (asize <= size) {
+            if (size == asize) {
+                return block;
+            }
+            if (best == NULL || size < get_size(best)) {
+                best = block;
+            }
+            seen++;
+        }
+    }
+    if (best != NULL || larger == 0) {
+        return best;
+    }
+    // Every block of the next class fits; pick the smallest of a few
+    block = arena->free_listp_array_tail[__builtin_ctzl(larger)];
+    best = block;
+    for (seen = 1; block != NULL && seen < MM_FIT_BEST_K; seen++) {
+        block = from_link(block->prev);
+        if (block != NULL && get_size(block) < get_size(best)) {
+            best = block;
+        }
+    }
+    return best;
+#elif MM_FIT_POLICY == MM_FIT_ADDRESS
+    // Lists are address ordered, so walk from the head
+    for (block = arena->free_listp_array[i]; block != NULL; block = from_link(block->next)) {
+        if ((asize <= get_size(block))) {
+            return block;
+        }
+    }
+    if (larger == 0) {
+        return NULL; // no fit found
+    }
+    return arena->free_listp_array[__builtin_ctzl(larger)];
+#else
+    for (block = arena->free_listp_array_tail[i]; block != NULL; block = from_link(block->prev)) {
+        if ((asize <= get_size(block))) {
+            return block;
+        }
+    }
+    if (larger == 0) {
+        return NULL; // no fit found
+    }
+    return arena->free_listp_array_tail[__builtin_ctzl(larger)];
+#endif
+}
+
+/*
+ * remove_mini_free_block: unlinks a mini block from the arena's mini list
+ *                         in constant time.
+ */
+static void remove_mini_free_block(arena_t *arena, block_t_2 *pointer)
+{
+    block_t_2 *block_prev = offset_to_mini(pointer->prev);
+    block_t_2 *block_next = offset_to_mini(pointer->next);
+
+    stat_add(arena->stats.free_blocks[0], -1);
+    stat_add(arena->stats.free_bytes, -dsize);
+
+    if (block_prev == NULL) {
+        arena->mini_listp = block_next;
+    } else {
+        block_prev->next = pointer->next;
+    }
+    if (block_next != NULL) {
+        block_next->prev = pointer->prev;
+    }
+}
+/*
+ * remove free blocks in from the free list
+ */
+static void remove_free_block(arena_t *arena, block_t* pointer) {
+    // printf("remove address: %p\n", pointer);
+    size_t size = get_size(pointer);
+    if (size == dsize) {
+        block_t_2 *block_mini = (block_t_2 *)pointer;
+        remove_mini_free_block(arena, block_mini);
+        return;
+    }
+
+    block_t* block_prev = from_link(pointer->prev);
+    block_t* block_next = from_link(pointer->next);
+
+    int free_list_number = get_number(get_size(pointer));
+    stat_add(arena->stats.free_blocks[free_list_number], -1);
+    stat_add(arena->stats.free_bytes, -size);
+
+    /* case 1: remove block when there is only one block in the list */
+    if (block_prev == NULL && block_next == NULL) {
+        arena->free_listp_array[free_list_number] = NULL;
+        arena->free_listp_array_tail[free_list_number] = NULL;
+        arena->nonempty_lists &= ~((uint64_t)1 << free_list_number);
+    } 
+    /* Case 2: remove the top element of the list*/
+    else if (block_prev == NULL && block_next != NULL) {
+        arena->free_listp_array[free_list_number] = block_next;
+        arena->free_listp_array[free_list_number]->prev = to_link(NULL);
+    }
+    /*Case 3: remove the last element of the list */
+    else if (block_prev != NULL && block_next == NULL) {
+        block_prev->next = to_link(NULL);
+        arena->free_listp_array_tail[free_list_number] = block_prev;
+    }
+    /*Case 4: remove the element in the middle*/
+    else if (block_prev != NULL && block_next != NULL){
+        block_prev->next = pointer->next;
+        block_next->prev = pointer->prev;
+    }
+}
+
+static void insert_free_block(arena_t *arena, block_t* pointer) {
+    size_t size = get_size(pointer);
+    int free_list_number = get_number(size);
+    stat_add(arena->stats.free_blocks[free_list_number], 1);
+    stat_add(arena->stats.free_bytes, size);
+
+    if (arena->free_listp_array[free_list_number] == NULL) {
+        arena->free_listp_array[free_list_number] = pointer;
+        arena->free_listp_array_tail[free_list_number] = pointer;
+        arena->nonempty_lists |= (uint64_t)1 << free_list_number;
+        pointer->prev = to_link(NULL);
+        pointer->next = to_link(NULL);
+        return;
+    }
+#if MM_FIT_POLICY == MM_FIT_ADDRESS
+    /* keep the list sorted by address */
+    block_t *block_prev = NULL;
+    block_t *block_next = arena->free_listp_array[free_list_number];
+    while (block_next != NULL && block_next < pointer) {
+        block_prev = block_next;
+        block_next = from_link(block_next->next);
+    }
+    pointer->prev = to_link(block_prev);
+    pointer->next = to_link(block_next);
+    if (block_prev == NULL) {
+        arena->free_listp_array[free_list_number] = pointer;
+    } else {
+        block_prev->next = to_link(pointer);
+    }
+    if (block_next == NULL) {
+        arena->free_listp_array_tail[free_list_number] = pointer;
+    } else {
+        block_next->prev = to_link(pointer);
+    }
+#else
+    pointer->prev = to_link(NULL);
+    pointer->next = to_link(arena->free_listp_array[free_list_number]);
+    arena->free_listp_array[free_list_number]->prev = to_link(pointer);
+     /* update the free_listp */
+    arena->free_listp_array[free_list_number] = pointer;
+#endif
+}
+
+static void insert_free_block_mini(arena_t *arena, block_t_2 *pointer) {
+    stat_add(arena->stats.free_blocks[0], 1);
+    stat_add(arena->stats.free_bytes, dsize);
+    pointer->prev = 0;
+    pointer->next = mini_to_offset(arena->mini_listp);
+    if (arena->mini_listp != NULL) {
+        arena->mini_listp->prev = mini_to_offset(pointer);
+    }
+     /* update the free_listp */
+    arena->mini_listp = pointer;
+}
+
+/*
+ * mini_to_offset: encodes a mini block as its distance from heap_start in
+ *                 16-byte units, which fits 32 bits for heaps up to 64 GiB.
+ *                 Block headers sit 8 bytes past a 16-byte boundary, so the
+ *                 first possible block encodes as 1 and 0 can mean NULL.
+ */
+static uint32_t mini_to_offset(block_t_2 *block)
+{
+    if (block == NULL) {
+        return 0;
+    }
+    return (uint32_t)(((char *)block - heap_start + wsize) / dsize);
+}
+
+/*
+ * offset_to_mini: inverse of mini_to_offset.
+ */
+static block_t_2 *offset_to_mini(uint32_t offset)
+{
+    if (offset == 0) {
+        return NULL;
+    }
+    return (block_t_2 *)(heap_start + (size_t)offset * dsize - wsize);
+}
+
+/*
+ * to_link: encodes a block, or NULL, as a free-list link.
+ */
+static link_t to_link(block_t *block)
+{
+#if MM_COMPACT_LINKS
+    return mini_to_offset((block_t_2 *)block);
+#else
+    return block;
+#endif
+}
+
+/*
+ * from_link: inverse of to_link.
+ */
+static block_t *from_link(link_t link)
+{
+#if MM_COMPACT_LINKS
+    return (block_t *)offset_to_mini(link);
+#else
+    return link;
+#endif
+}
+
+#if MM_MMAP_THRESHOLD > 0
+/*
+ * mmap_block: serves a large request with its own anonymous mapping:
+ *                 map                map+8    map+16
+ *             | (unused word) | HEADER | PAYLOAD ... |
+ *             The header's size reaches to the end of the mapping, less a
+ *             word, and has mmap_mask set; no free list or arena ever sees
+ *             the block. For an alignment above 16 the payload starts
+ *             further in, and the mapping is cut down so that it starts
+ *             less than a page before the header (see map_start). With
+ *             MM_HUGE, blocks of a huge page or more are aligned to one.
+ */
+static void *mmap_block(size_t alignment, size_t asize)
+{
+#if MM_HUGE
+    if (asize >= MM_HUGE_SIZE && alignment < MM_HUGE_SIZE)
+    {
+        alignment = MM_HUGE_SIZE;
+    }
+#endif
+    size_t extra = (alignment > ALIGNMENT) ? alignment : 0;
+    size_t reserve = round_up(asize + dsize + extra, PAGE_SIZE);
+    char *map = mmap(NULL, reserve, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+    if (map == MAP_FAILED)
+    {
+        return NULL;
+    }
+    char *bp = (char *)round_up((uintptr_t)map + dsize, alignment);
+    char *start = (char *)(((uintptr_t)bp - dsize) & ~(PAGE_SIZE - 1));
+    char *end = (char *)round_up((uintptr_t)bp + asize, PAGE_SIZE);
+    if (start > map)
+    {
+        munmap(map, start - map);
+    }
+    if (end < map + reserve)
+    {
+        munmap(end, map + reserve - end);
+    }
+#if MM_HUGE
+    if (asize >= MM_HUGE_SIZE)
+    {
+        // All of the mapping, so that it stays one area for mremap
+        madvise(start, end - start, MADV_HUGEPAGE);
+    }
+#endif
+    block_t *block = payload_to_header(bp);
+    block->header = pack(end - bp, true, true, false) | mmap_mask;
+    stat_add_atomic(mmap_stats.allocs, 1);
+    stat_add_atomic(mmap_stats.alloc_bytes, end - bp);
+    profile_alloc(bp, end - bp);
+    return bp;
+}
+
+/*
+ * map_start: the start of a mapped block's mapping, the page holding the
+ *            word before its header.
+ */
+static char *map_start(block_t *block)
+{
+    return (char *)(((uintptr_t)block - wsize) & ~(PAGE_SIZE - 1));
+}
+
+/*
+ * munmap_block: returns a mapped block's memory to the OS.
+ */
+static void munmap_block(block_t *block)
+{
+    char *start = map_start(block);
+
+    stat_add_atomic(mmap_stats.frees, 1);
+    stat_add_atomic(mmap_stats.freed_bytes, get_size(block));
+    profile_free(header_to_payload(block));
+    munmap(start, (char *)block + get_size(block) + wsize - start);
+}
+
+/*
+ * mremap_block: resizes a mapped block to hold asize bytes, letting the
+ *               kernel move the pages instead of copying them. The header
+ *               keeps its offset into the mapping. Returns NULL and leaves
+ *               the block untouched on failure.
+ */
+static void *mremap_block(block_t *block, size_t asize)
+{
+    char *start = map_start(block);
+    size_t head = (char *)block - start;
+    size_t old_size = get_size(block);
+    size_t old_length = head + old_size + wsize;
+    size_t length = round_up(head + asize + wsize, PAGE_SIZE);
+
+    if (length == old_length)
+    {
+        return header_to_payload(block);
+    }
+    char *map = mremap(start, old_length, length, MREMAP_MAYMOVE);
+    if (map == MAP_FAILED)
+    {
+        return NULL;
+    }
+    profile_free(header_to_payload(block));
+    size_t size = length - head - wsize;
+    block = (block_t *)(map + head);
+    block->header = pack(size, true, true, false) | mmap_mask;
+    // Counted as freeing the old mapping and allocating the new one
+    stat_add_atomic(mmap_stats.frees, 1);
+    stat_add_atomic(mmap_stats.freed_bytes, old_size);
+    stat_add_atomic(mmap_stats.allocs, 1);
+    stat_add_atomic(mmap_stats.alloc_bytes, size);
+    profile_alloc(header_to_payload(block), size);
+    return header_to_payload(block);
+}
+#endif /* MM_MMAP_THRESHOLD > 0 */
+
+/*
+ * mm_trim: releases all free heap pages it can right away: parked blocks
+ *          are coalesced, the heap top is trimmed down to a growth step,
+ *          ignoring recent demand, and every free block of at least a page
+ *          is purged. Returns the number of bytes released.
+ */
+size_t mm_trim(void)
+{
+    size_t released = 0;
+
+#if MM_PURGE
+    for (int a = 0; a < MM_ARENAS; a++) {
+        arena_t *arena = &arenas[a];
+        lock_arena(arena);
+        if (heap_listp != NULL) {
+#if MM_LAZY_COALESCE
+            quick_flush_all(arena);
+#endif
+            arena->top_mark = NULL;
+            arena->top_keep = 0;
+            released += purge_arena(arena, PAGE_SIZE);
+        }
+        unlock_arena(arena);
+    }
+#endif
+    return released;
+}
+
+/*
+ * mm_background_start: starts the maintenance thread, waking every
+ *                      interval_ns nanoseconds. Returns false if it is
+ *                      already running, cannot be created, or the build
+ *                      has no MM_BACKGROUND.
+ */
+bool mm_background_start(uint64_t interval_ns)
+{
+#if MM_BACKGROUND
+    bool ok = false;
+
+    pthread_mutex_lock(&bg_control);
+    if (!bg_running && interval_ns > 0) {
+        bg_interval_ns = interval_ns;
+        bg_stop = false;
+        ok = (pthread_create(&bg_thread, NULL, bg_main, NULL) == 0);
+        __atomic_store_n(&bg_running, ok, __ATOMIC_RELAXED);
+    }
+    pthread_mutex_unlock(&bg_control);
+    return ok;
+#else
+    (void)interval_ns;
+    return false;
+#endif
+}
+
+/*
+ * mm_background_stop: stops the maintenance thread and waits for it, then
+ *                     runs one last pass for what was parked meanwhile;
+ *                     free coalesces, trims and purges inline afterwards.
+ */
+void mm_background_stop(void)
+{
+#if MM_BACKGROUND
+    pthread_mutex_lock(&bg_control);
+    if (bg_running) {
+        pthread_mutex_lock(&bg_lock);
+        bg_stop = true;
+        pthread_cond_signal(&bg_wake);
+        pthread_mutex_unlock(&bg_lock);
+        pthread_join(bg_thread, NULL);
+        __atomic_store_n(&bg_running, false, __ATOMIC_RELAXED);
+        bg_tick();
+    }
+    pthread_mutex_unlock(&bg_control);
+#endif
+}
+
+#if MM_BACKGROUND
+/*
+ * bg_main: body of the maintenance thread; one bg_tick per interval until
+ *          mm_background_stop.
+ */
+static void *bg_main(void *arg)
+{
+    struct timespec ts;
+
+    pthread_mutex_lock(&bg_lock);
+    while (!bg_stop) {
+        clock_gettime(CLOCK_REALTIME, &ts);
+        uint64_t ns = (uint64_t)ts.tv_nsec + bg_interval_ns;
+        ts.tv_sec += ns / 1000000000;
+        ts.tv_nsec = ns % 1000000000;
+        pthread_cond_timedwait(&bg_wake, &bg_lock, &ts);
+        if (!bg_stop) {
+            pthread_mutex_unlock(&bg_lock);
+            bg_tick();
+            pthread_mutex_lock(&bg_lock);
+        }
+    }
+    pthread_mutex_unlock(&bg_lock);
+    return arg;
+}
+
+/*
+ * bg_tick: one maintenance pass, arena by arena. Remote frees are drained,
+ *          parked blocks coalesced, and the frees since the last pass
+ *          trimmed and purged as note_free would have.
+ */
+static void bg_tick(void)
+{
+    for (int a = 0; a < MM_ARENAS; a++) {
+        arena_t *arena = &arenas[a];
+        lock_arena(arena);
+        lock_init();
+        if (heap_listp != NULL) {
+            drain_remote(arena);
+#if MM_LAZY_COALESCE
+            quick_flush_all(arena);
+#endif
+#if MM_PURGE
+            if (arena->dirty_bytes > 0) {
+                purge_arena(arena, MM_PURGE_MIN);
+            }
+#endif
+        }
+        unlock_init();
+        unlock_arena(arena);
+    }
+}
+#endif
+
+/*
+ * count_alloc: counts an allocation of size bytes handed out at bp, unless
+ *              bp is NULL; returns bp. count_free counts the free of size
+ *              bytes at bp. Both count in the calling thread's counters
+ *              and report to the profiler.
+ */
+static void *count_alloc(void *bp, size_t size)
+{
+    if (bp != NULL) {
+        stat_add(thread_stats.allocs, 1);
+        stat_add(thread_stats.alloc_bytes, size);
+        profile_alloc(bp, size);
+    }
+    return bp;
+}
+
+static void count_free(void *bp, size_t size)
+{
+    stat_add(thread_stats.frees, 1);
+    stat_add(thread_stats.freed_bytes, size);
+    profile_free(bp);
+}
+
+#if MM_STATS
+/*
+ * fold_stats: moves the calling thread's counters into the arena, whose
+ *             lock the caller holds.
+ */
+static void fold_stats(arena_t *arena)
+{
+    thread_stats_t *t = &thread_stats;
+    thread_stats_t *f = &arena->stats.folded;
+
+    if (t->allocs == 0 && t->frees == 0 && t->remote_frees == 0) {
+        return;
+    }
+    f->allocs += t->allocs;
+    f->alloc_bytes += t->alloc_bytes;
+    f->frees += t->frees;
+    f->freed_bytes += t->freed_bytes;
+    f->tcache_hits += t->tcache_hits;
+    f->remote_frees += t->remote_frees;
+    memset(t, 0, sizeof(*t));
+}
+#endif
+
+/*
+ * mm_stats: a snapshot of the allocator's counters, summed over all
+ *           arenas. Counts of other threads that have not taken an arena
+ *           lock since are not included yet.
+ */
+mm_stats_t mm_stats(void)
+{
+    mm_stats_t stats;
+
+    memset(&stats, 0, sizeof(stats));
+    lock_sbrk();
+    stats.heap_bytes = mem_heapsize();
+    unlock_sbrk();
+    for (int a = 0; a < MM_ARENAS; a++) {
+        arena_t *arena = &arenas[a];
+        lock_arena(arena);
+        stats.purged_bytes += arena->purged_bytes;
+        stats.trimmed_bytes += arena->trimmed_bytes;
+        stats.lazy_bytes += arena->lazy_bytes;
+#if MM_STATS
+        arena_stats_t *as = &arena->stats;
+        stats.allocs += as->folded.allocs;
+        stats.alloc_bytes += as->folded.alloc_bytes;
+        stats.frees += as->folded.frees;
+        stats.freed_bytes += as->folded.freed_bytes;
+        stats.tcache_hits += as->folded.tcache_hits;
+        stats.remote_frees += as->folded.remote_frees;
+        stats.tcache_refills += as->tcache_refills;
+        stats.tcache_flushes += as->tcache_flushes;
+        stats.extend_heap += as->extend_heap;
+        stats.extend_heap_bytes += as->extend_heap_bytes;
+        stats.extend_heap_overshoot += as->extend_heap_overshoot;
+        for (int i = 0; i < 4; i++) {
+            stats.coalesce[i] += as->coalesce[i];
+        }
+        for (int i = 0; i < LIST_NUM; i++) {
+            stats.class_allocs[i] += as->class_allocs[i];
+            stats.free_blocks[i] += as->free_blocks[i];
+        }
+        stats.free_bytes += as->free_bytes;
+        stats.slab_runs += as->slab_runs;
+        stats.lazy_hits += as->lazy_hits;
+#endif
+        unlock_arena(arena);
+    }
+#if MM_STATS
+    thread_stats_t mapped;
+    mapped.allocs = __atomic_load_n(&mmap_stats.allocs, __ATOMIC_RELAXED);
+    mapped.alloc_bytes = __atomic_load_n(&mmap_stats.alloc_bytes, __ATOMIC_RELAXED);
+    mapped.frees = __atomic_load_n(&mmap_stats.frees, __ATOMIC_RELAXED);
+    mapped.freed_bytes = __atomic_load_n(&mmap_stats.freed_bytes, __ATOMIC_RELAXED);
+    stats.mapped_blocks = mapped.allocs - mapped.frees;
+    stats.mapped_bytes = mapped.alloc_bytes - mapped.freed_bytes;
+    stats.allocs += mapped.allocs;
+    stats.alloc_bytes += mapped.alloc_bytes;
+    stats.frees += mapped.frees;
+    stats.freed_bytes += mapped.freed_bytes;
+    // Another thread's frees may be folded before its allocations
+    if (stats.alloc_bytes > stats.freed_bytes) {
+        stats.in_use_bytes = stats.alloc_bytes - stats.freed_bytes;
+    }
+    if (stats.allocs > stats.frees) {
+        stats.in_use_count = stats.allocs - stats.frees;
+    }
+#endif
+    return stats;
+}
+
+/*
+ * class_min_size: the smallest block size in segregated class number, or
+ *                 0 if get_number never returns it.
+ */
+static size_t class_min_size(int number)
+{
+    if (number == 0) {
+        return dsize;
+    }
+#ifdef MM_CLASS_BOUNDS
+    return ((size_t)number <= CLASS_BOUNDS_NUM) ? class_bounds[number - 1] : 0;
+#else
+    int log2 = LIST_MIN_SHIFT + (number >> MM_CLASS_SUBDIV);
+    size_t sub = (size_t)(number & ((1 << MM_CLASS_SUBDIV) - 1));
+    return ((size_t)1 << log2) + (sub << (log2 - MM_CLASS_SUBDIV));
+#endif
+}
+
+/*
+ * json_printf: appends formatted text at offset n of buf, truncating it to
+ *              the size bytes of buf; returns the offset past the full
+ *              text, as snprintf does.
+ */
+static size_t json_printf(char *buf, size_t size, size_t n, const char *fmt, ...)
+{
+    va_list ap;
+
+    va_start(ap, fmt);
+    int len = vsnprintf((n < size) ? buf + n : NULL, (n < size) ? size - n : 0,
+                        fmt, ap);
+    va_end(ap);
+    return n + (size_t)((len > 0) ? len : 0);
+}
+
+/*
+ * json_array: appends "name":[values...], to the JSON text at offset n.
+ */
+static size_t json_array(char *buf, size_t size, size_t n, const char *name,
+                         const uint64_t *values, int count)
+{
+    n = json_printf(buf, size, n, "\"%s\":[", name);
+    for (int i = 0; i < count; i++) {
+        n = json_printf(buf, size, n, "%s%llu", (i > 0) ? "," : "",
+                        (unsigned long long)values[i]);
+    }
+    return json_printf(buf, size, n, "],");
+}
+
+/*
+ * mm_stats_json: writes mm_stats() as one JSON object into buf, like
+ *                snprintf: at most size bytes, NUL-terminated if size > 0.
+ *                Returns the length of the whole object.
+ */
+size_t mm_stats_json(char *buf, size_t size)
+{
+    mm_stats_t st = mm_stats();
+    const struct {
+        const char *name;
+        uint64_t value;
+    } fields[] = {
+        { "heap_bytes", st.heap_bytes },
+        { "mapped_bytes", st.mapped_bytes },
+        { "mapped_blocks", st.mapped_blocks },
+        { "in_use_bytes", st.in_use_bytes },
+        { "in_use_count", st.in_use_count },
+        { "allocs", st.allocs },
+        { "alloc_bytes", st.alloc_bytes },
+        { "frees", st.frees },
+        { "freed_bytes", st.freed_bytes },
+        { "free_bytes", st.free_bytes },
+        { "slab_runs", st.slab_runs },
+        { "tcache_hits", st.tcache_hits },
+        { "tcache_refills", st.tcache_refills },
+        { "tcache_flushes", st.tcache_flushes },
+        { "remote_frees", st.remote_frees },
+        { "lazy_hits", st.lazy_hits },
+        { "lazy_bytes", st.lazy_bytes },
+        { "extend_heap", st.extend_heap },
+        { "extend_heap_bytes", st.extend_heap_bytes },
+        { "extend_heap_overshoot", st.extend_heap_overshoot },
+        { "purged_bytes", st.purged_bytes },
+        { "trimmed_bytes", st.trimmed_bytes },
+    };
+    uint64_t min_size[MM_STATS_CLASSES];
+    size_t n = json_printf(buf, size, 0, "{");
+
+    for (size_t i = 0; i < sizeof(fields) / sizeof(fields[0]); i++) {
+        n = json_printf(buf, size, n, "\"%s\":%llu,", fields[i].name,
+                        (unsigned long long)fields[i].value);
+    }
+    for (int i = 0; i < MM_STATS_CLASSES; i++) {
+        min_size[i] = class_min_size(i);
+    }
+    n = json_array(buf, size, n, "coalesce", st.coalesce, 4);
+    n = json_array(buf, size, n, "class_min_size", min_size, MM_STATS_CLASSES);
+    n = json_array(buf, size, n, "free_blocks", st.free_blocks, MM_STATS_CLASSES);
+    n = json_array(buf, size, n, "class_allocs", st.class_allocs, MM_STATS_CLASSES);
+    // Replace the comma after the last array
+    if (n < size) {
+        buf[n - 1] = '}';
+    }
+    return n;
+}
+
+/*
+ * profile_alloc/profile_free: the profiler's hooks on every allocation and
+ *     free. They only read a global unless a profile is running. Sample
+ *     points fall on the allocated bytes at exponential gaps of mean rate;
+ *     an allocation holding at least one of them is sampled.
+ */
+static void profile_alloc(void *bp, size_t size)
+{
+#if MM_PROFILE
+    size_t rate = __atomic_load_n(&prof.rate, __ATOMIC_RELAXED);
+
+    if (rate == 0) {
+        return;
+    }
+    prof_countdown -= (int64_t)size;
+    if (prof_countdown >= 0 || prof_busy) {
+        return;
+    }
+    // The gap runs from the last sample point, not from the end of this
+    // allocation; further points inside it are part of the same sample
+    do {
+        prof_countdown += prof_gap(rate);
+    } while (prof_countdown < 0);
+    profile_sample(bp, size, rate);
+#else
+    (void)bp;
+    (void)size;
+#endif
+}
+
+static void profile_free(void *bp)
+{
+#if MM_PROFILE
+    if (__atomic_load_n(&prof.nlive, __ATOMIC_RELAXED) != 0) {
+        profile_release(bp);
+    }
+#else
+    (void)bp;
+#endif
+}
+
+#if MM_PROFILE
+/*
+ * prof_gap: a random gap between sample points, exponentially distributed
+ *           with mean rate, so that every byte is sampled with the same
+ *           probability and periodic patterns are not aliased.
+ */
+static int64_t prof_gap(size_t rate)
+{
+    if (prof_rng == 0) {
+        prof_rng = (uintptr_t)&prof_rng * 0x9E3779B97F4A7C15ULL | 1;
+    }
+    prof_rng ^= prof_rng >> 12;
+    prof_rng ^= prof_rng << 25;
+    prof_rng ^= prof_rng >> 27;
+    // Uniform in (0, 1], from the top 53 bits
+    double u = (double)((prof_rng * 0x2545F4914F6CDD1DULL >> 11) + 1) / 0x1p53;
+    return (int64_t)(-log(u) * (double)rate);
+}
+
+/*
+ * profile_sample: records a sampled allocation of size bytes at bp. An
+ *                 allocation of size bytes is sampled with probability
+ *                 1 - exp(-size / rate), so it stands for size divided by
+ *                 that many bytes allocated at its call site and size class.
+ */
+__attribute__((noinline))
+static void profile_sample(void *bp, size_t size, size_t rate)
+{
+    void *frames[MM_PROFILE_DEPTH + 1];
+
+    // backtrace may allocate the first time; do not sample that
+    prof_busy = true;
+    int depth = backtrace(frames, MM_PROFILE_DEPTH + 1);
+    prof_busy = false;
+    uint64_t bytes = (uint64_t)((double)size / -expm1(-(double)size / (double)rate));
+    uint64_t now = prof_now();
+    int number = get_number(size);
+
+    pthread_mutex_lock(&prof_lock);
+    if (prof.rate == 0) {
+        pthread_mutex_unlock(&prof_lock);
+        return;
+    }
+    prof.samples++;
+    prof.class_samples[number]++;
+    prof.class_bytes[number] += bytes;
+    // Leave out the frame of profile_sample itself
+    prof_site_t *site = prof_site(frames + 1, depth - 1);
+    if (site == NULL) {
+        prof.dropped++;
+        pthread_mutex_unlock(&prof_lock);
+        return;
+    }
+    site->samples++;
+    site->bytes += bytes;
+
+    if (prof.nused >= MM_PROFILE_LIVE * 3 / 4) {
+        // Compact into the other table; free may still probe the old one
+        prof_live_t *table = prof_tables[prof.live == prof_tables[0]];
+        memset(table, 0, sizeof(prof_tables[0]));
+        for (size_t i = 0; i < MM_PROFILE_LIVE; i++) {
+            void *p = prof.live[i].bp;
+            if (p != NULL && p != PROF_DELETED) {
+                *prof_find(table, p) = prof.live[i];
+            }
+        }
+        __atomic_store_n(&prof.live, table, __ATOMIC_RELEASE);
+        prof.nused = prof.nlive;
+    }
+    if (prof.nused >= MM_PROFILE_LIVE * 3 / 4) {
+        // Too many live samples to follow: no lifetime for this one
+        prof.dropped++;
+        pthread_mutex_unlock(&prof_lock);
+        return;
+    }
+    prof_live_t *entry = prof_find(prof.live, bp);
+    if (entry->bp == bp) {
+        // bp was freed without being seen; replace the old sample
+        entry->site->live_bytes -= entry->bytes;
+    } else {
+        prof.nused += (entry->bp == NULL);
+        __atomic_store_n(&prof.nlive, prof.nlive + 1, __ATOMIC_RELAXED);
+    }
+    site->live_bytes += bytes;
+    entry->site = site;
+    entry->bytes = bytes;
+    entry->start_ns = now;
+    entry->number = number;
+    __atomic_store_n(&entry->bp, bp, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&prof_lock);
+}
+
+/*
+ * profile_release: ends the lifetime of the sample at bp, if there is one.
+ *                  The live table is probed without the lock first, so
+ *                  frees of unsampled objects do not serialize.
+ */
+static void profile_release(void *bp)
+{
+    prof_live_t *table = __atomic_load_n(&prof.live, __ATOMIC_ACQUIRE);
+
+    if (table == NULL || __atomic_load_n(&prof_find(table, bp)->bp, __ATOMIC_ACQUIRE) != bp) {
+        return;
+    }
+    uint64_t now = prof_now();
+    pthread_mutex_lock(&prof_lock);
+    prof_live_t *entry = (prof.live != NULL) ? prof_find(prof.live, bp) : NULL;
+    if (entry != NULL && entry->bp == bp) {
+        uint64_t lifetime = now - entry->start_ns;
+        entry->site->frees++;
+        entry->site->lifetime_ns += lifetime;
+        entry->site->live_bytes -= entry->bytes;
+        prof.class_frees[entry->number]++;
+        prof.class_lifetime_ns[entry->number] += lifetime;
+        __atomic_store_n(&entry->bp, PROF_DELETED, __ATOMIC_RELAXED);
+        __atomic_store_n(&prof.nlive, prof.nlive - 1, __ATOMIC_RELAXED);
+    }
+    pthread_mutex_unlock(&prof_lock);
+}
+
+/*
+ * prof_find: the entry of bp in a live table, or else the slot where bp
+ *            would be inserted: the first deleted slot on its probe
+ *            sequence, or the empty slot ending it.
+ */
+static prof_live_t *prof_find(prof_live_t *table, void *bp)
+{
+    size_t mask = MM_PROFILE_LIVE - 1;
+    size_t i = (size_t)(((uintptr_t)bp >> 4) * 0x9E3779B97F4A7C15ULL >> 32) & mask;
+    prof_live_t *deleted = NULL;
+
+    for (;; i = (i + 1) & mask) {
+        void *p = __atomic_load_n(&table[i].bp, __ATOMIC_ACQUIRE);
+        if (p == bp) {
+            return &table[i];
+        }
+        if (p == NULL) {
+            return (deleted != NULL) ? deleted : &table[i];
+        }
+        if (p == PROF_DELETED && deleted == NULL) {
+            deleted = &table[i];
+        }
+    }
+}
+
+/*
+ * prof_site: the site of a stack, added if it is new. Returns NULL if the
+ *            site table is full. The caller holds prof_lock.
+ */
+static prof_site_t *prof_site(void **frames, int depth)
+{
+    uint64_t hash = 0xCBF29CE484222325ULL;
+    for (int i = 0; i < depth; i++) {
+        hash = (hash ^ (uintptr_t)frames[i]) * 0x100000001B3ULL;
+    }
+    hash |= 1;
+
+    size_t mask = MM_PROFILE_SITES - 1;
+    for (size_t n = 0, i = hash & mask; n < MM_PROFILE_SITES; n++, i = (i + 1) & mask) {
+        prof_site_t *site = &prof.sites[i];
+        if (site->hash == hash) {
+            return site;
+        }
+        if (site->hash == 0) {
+            site->hash = hash;
+            site->depth = depth;
+            memcpy(site->frames, frames, depth * sizeof(void *));
+            return site;
+        }
+    }
+    return NULL;
+}
+
+static uint64_t prof_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/*
+ * frame_name: writes the symbol of a return address into buf, or else its
+ *             object file and offset for addr2line; returns the length.
+ */
+static size_t frame_name(void *pc, char *buf, size_t size)
+{
+    Dl_info info;
+    int found = dladdr(pc, &info);
+    int len;
+
+    if (found && info.dli_sname != NULL) {
+        len = snprintf(buf, size, "%s", info.dli_sname);
+    } else if (found && info.dli_fname != NULL) {
+        const char *base = strrchr(info.dli_fname, '/');
+        len = snprintf(buf, size, "%s+0x%lx", (base != NULL) ? base + 1 : info.dli_fname,
+                       (unsigned long)((char *)pc - (char *)info.dli_fbase));
+    } else {
+        len = snprintf(buf, size, "0x%lx", (unsigned long)(uintptr_t)pc);
+    }
+    return (len < 0) ? 0 : ((size_t)len < size) ? (size_t)len : size - 1;
+}
+#endif /* MM_PROFILE */
+
+/*
+ * mm_profile_start: starts a new profile sampling every rate bytes on
+ *                   average, discarding the previous one; rate 0 stops
+ *                   sampling and keeps the profile for the reports.
+ *                   Returns false if profiling is compiled out.
+ */
+bool mm_profile_start(size_t rate)
+{
+#if MM_PROFILE
+    pthread_mutex_lock(&prof_lock);
+    if (rate != 0) {
+        memset(&prof, 0, sizeof(prof));
+        memset(prof_tables, 0, sizeof(prof_tables));
+        prof.live = prof_tables[0];
+    } else {
+        // Lifetimes of the objects still live are not followed any more
+        __atomic_store_n(&prof.nlive, 0, __ATOMIC_RELAXED);
+    }
+    __atomic_store_n(&prof.rate, rate, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&prof_lock);
+    return true;
+#else
+    (void)rate;
+    return false;
+#endif
+}
+
+/*
+ * mm_profile_dump: writes the profile's call sites to fd in the folded
+ *                  format of flamegraph.pl, one line per site: its frames
+ *                  outermost first, separated by ';', and the estimated
+ *                  bytes allocated there, or still live if live is set.
+ *                  Returns 0, or -1 if a write fails.
+ */
+int mm_profile_dump(int fd, bool live)
+{
+#if MM_PROFILE
+    char line[4096];
+    int ret = 0;
+
+    pthread_mutex_lock(&prof_lock);
+    for (size_t i = 0; i < MM_PROFILE_SITES && ret == 0; i++) {
+        prof_site_t *site = &prof.sites[i];
+        uint64_t bytes = live ? site->live_bytes : site->bytes;
+        if (site->hash == 0 || bytes == 0) {
+            continue;
+        }
+        // Keep room for the count at the end of the line
+        size_t n = 0;
+        for (int f = site->depth - 1; f >= 0 && n < sizeof(line) - 64; f--) {
+            n += frame_name(site->frames[f], line + n, sizeof(line) - 64 - n);
+            line[n++] = (f > 0) ? ';' : ' ';
+        }
+        n += snprintf(line + n, sizeof(line) - n, "%llu\n", (unsigned long long)bytes);
+        if (write(fd, line, n) != (ssize_t)n) {
+            ret = -1;
+        }
+    }
+    pthread_mutex_unlock(&prof_lock);
+    return ret;
+#else
+    (void)fd;
+    (void)live;
+    return -1;
+#endif
+}
+
+/*
+ * mm_profile_json: writes the profile's size-class histogram and per-site
+ *                  totals as one JSON object into buf, like mm_stats_json.
+ */
+size_t mm_profile_json(char *buf, size_t size)
+{
+#if MM_PROFILE
+    uint64_t lifetime[LIST_NUM];
+    const char *sep = "";
+
+    pthread_mutex_lock(&prof_lock);
+    size_t n = json_printf(buf, size, 0, "{\"rate\":%zu,\"samples\":%llu,"
+                           "\"dropped\":%llu,\"live_samples\":%zu,", prof.rate,
+                           (unsigned long long)prof.samples,
+                           (unsigned long long)prof.dropped, prof.nlive);
+    for (int i = 0; i < LIST_NUM; i++) {
+        lifetime[i] = (prof.class_frees[i] > 0)
+                      ? prof.class_lifetime_ns[i] / prof.class_frees[i] : 0;
+    }
+    n = json_array(buf, size, n, "class_samples", prof.class_samples, LIST_NUM);
+    n = json_array(buf, size, n, "class_bytes", prof.class_bytes, LIST_NUM);
+    n = json_array(buf, size, n, "class_frees", prof.class_frees, LIST_NUM);
+    n = json_array(buf, size, n, "class_lifetime_ns", lifetime, LIST_NUM);
+    n = json_printf(buf, size, n, "\"sites\":[");
+    for (size_t i = 0; i < MM_PROFILE_SITES; i++) {
+        prof_site_t *site = &prof.sites[i];
+        if (site->hash == 0) {
+            continue;
+        }
+        // frames[0] is the allocator's entry point, frames[1] its caller
+        char name[256];
+        frame_name(site->frames[(site->depth > 1) ? 1 : 0], name, sizeof(name));
+        n = json_printf(buf, size, n, "%s{\"hash\":\"%016llx\",\"caller\":\"%s\","
+                        "\"samples\":%llu,\"bytes\":%llu,\"live_bytes\":%llu,"
+                        "\"frees\":%llu,\"lifetime_ns\":%llu}", sep,
+                        (unsigned long long)site->hash, name,
+                        (unsigned long long)site->samples,
+                        (unsigned long long)site->bytes,
+                        (unsigned long long)site->live_bytes,
+                        (unsigned long long)site->frees,
+                        (unsigned long long)((site->frees > 0)
+                                             ? site->lifetime_ns / site->frees : 0));
+        sep = ",";
+    }
+    pthread_mutex_unlock(&prof_lock);
+    return json_printf(buf, size, n, "]}");
+#else
+    return json_printf(buf, size, 0, "{}");
+#endif
+}
+
+/*
+ * purge_span: the whole pages (huge pages with MM_HUGE) inside a free
+ *             block that hold neither its header and list links nor its
+ *             footer. These are the pages a purge releases and that read
+ *             as zero while purged_mask is set.
+ */
+static void purge_span(block_t *block, char **lo, char **hi)
+{
+    *lo = (char *)round_up((uintptr_t)block + sizeof(block_t), RELEASE_SIZE);
+    *hi = (char *)(((uintptr_t)block + get_size(block) - wsize) & ~(RELEASE_SIZE - 1));
+}
+
+/*
+ * mark_top: notes that an allocation ended at end, where block_next is
+ *           the block after it; if that is the end of a region, trim_block
+ *           keeps the pages up to end resident.
+ */
+static void mark_top(arena_t *arena, block_t *end, block_t *block_next)
+{
+#if MM_PURGE
+    if ((char *)end > arena->top_mark && get_size(block_next) == 0) {
+        arena->top_mark = (char *)end;
+    }
+#else
+    (void)arena;
+    (void)end;
+    (void)block_next;
+#endif
+}
+
+#if MM_PURGE
+/*
+ * note_free: bookkeeping after free_block released size bytes that ended up
+ *            in the coalesced free block. Trims the heap top and runs a
+ *            purge pass once enough bytes have been freed.
+ */
+static void note_free(arena_t *arena, block_t *block, size_t size)
+{
+#if MM_BACKGROUND
+    // The background thread trims and purges while it runs
+    if (__atomic_load_n(&bg_running, __ATOMIC_RELAXED)) {
+        arena->dirty_bytes += size;
+        return;
+    }
+#endif
+    // trim_block keeps at least a growth step of slack for the next
+    // mallocs; trim only when more than that is free
+    if (get_size(block) >= MM_TRIM_THRESHOLD + arena->grow
+        && get_size(find_next(block)) == 0) {
+        trim_block(arena, block);
+    }
+    arena->dirty_bytes += size;
+    if (arena->dirty_bytes >= MM_PURGE_INTERVAL) {
+        purge_arena(arena, MM_PURGE_MIN);
+    }
+}
+
+/*
+ * trim_block: gives back the tail of the free block at the end of one of
+ *             the arena's regions. A pad at its start stays for the next
+ *             mallocs: at least a growth step, and at least top_keep, the
+ *             most allocated out of such a block lately; purge_arena halves
+ *             top_keep every pass, so the pad decays once demand drops. The
+ *             heap shrinks if mem_sbrk can and the arena owns the heap top;
+ *             otherwise the pages above the pad are purged, skipping those
+ *             still purged by the last trim. Returns bytes released.
+ */
+static size_t trim_block(arena_t *arena, block_t *block)
+{
+    size_t size = get_size(block);
+    char *start = (char *)block;
+    char *mark = arena->top_mark;
+
+    if (mark > start && mark <= start + size) {
+        arena->top_keep = max(arena->top_keep, mark - start);
+    }
+    if (arena->top_clean < mark) {
+        // Pages below mark were touched since the last trim
+        arena->top_clean = NULL;
+    }
+    arena->top_mark = NULL;
+    size_t keep = max(max(arena->grow, chunksize), arena->top_keep);
+    if (keep >= size) {
+        return 0;
+    }
+#ifdef MM_SBRK_SHRINKS
+    size_t excess = (size - keep) & ~(RELEASE_SIZE - 1);
+
+    lock_sbrk();
+    // The end of the arena's region is the heap top only if it owns that
+    if (excess > 0 && heap_top_arena == arena && get_size(find_next(block)) == 0
+        && mem_sbrk(-(intptr_t)excess) != (void *)-1)
+    {
+        remove_free_block(arena, block);
+        write_header(block, size - excess, false, get_prev_alloc(block), get_prev_mini(block));
+        write_footer(block, size - excess, false, get_prev_alloc(block), get_prev_mini(block));
+        write_header(find_next(block), 0, true, false, false);
+        insert_free_block(arena, block);
+        unlock_sbrk();
+        arena->trimmed_bytes += excess;
+        return excess;
+    }
+    unlock_sbrk();
+#endif
+    if (block->header & purged_mask) {
+        return 0;
+    }
+    char *lo;
+    char *hi;
+
+    purge_span(block, &lo, &hi);
+    lo = (char *)max((uintptr_t)lo, round_up((uintptr_t)start + keep, RELEASE_SIZE));
+    if (arena->top_clean > start && arena->top_clean < hi) {
+        // The pages above top_clean are still purged
+        hi = (char *)max((uintptr_t)lo, (uintptr_t)arena->top_clean);
+    }
+    size_t released = (hi > lo) ? hi - lo : 0;
+    if (released > 0 && madvise(lo, released, MADV_DONTNEED) != 0) {
+        return 0;
+    }
+    arena->top_clean = lo;
+    arena->purged_bytes += released;
+    return released;
+}
+
+/*
+ * purge_block: releases the whole pages inside a free block with
+ *              madvise(MADV_DONTNEED), leaving the header, list links and
+ *              footer resident, and marks the block purged. Any later
+ *              write_header clears the mark, so a block is purged again only
+ *              after it has been reused or merged. Returns bytes released.
+ */
+static size_t purge_block(arena_t *arena, block_t *block)
+{
+    if (block->header & purged_mask) {
+        return 0;
+    }
+    char *lo;
+    char *hi;
+
+    purge_span(block, &lo, &hi);
+    if (hi <= lo || madvise(lo, hi - lo, MADV_DONTNEED) != 0) {
+        return 0;
+    }
+    block->header |= purged_mask;
+    arena->purged_bytes += hi - lo;
+    return hi - lo;
+}
+/*
+ * purge_arena: purges every free block of at least min_size bytes in the
+ *              arena and trims the heap top if the arena owns it. The caller
+ *              holds the arena lock. Returns the number of bytes released.
+ */
+static size_t purge_arena(arena_t *arena, size_t min_size)
+{
+    size_t released = 0;
+    int first = get_number(min_size);
+    uint64_t lists = arena->nonempty_lists & (~(uint64_t)0 << first);
+
+    arena->dirty_bytes = 0;
+    while (lists != 0) {
+        int i = __builtin_ctzl(lists);
+        lists &= lists - 1;
+        block_t *block = arena->free_listp_array[i];
+        while (block != NULL) {
+            // trim_block may move the block within the lists
+            block_t *block_next = from_link(block->next);
+            if (get_size(block) >= min_size) {
+                if (get_size(find_next(block)) == 0) {
+                    released += trim_block(arena, block);
+                } else {
+                    released += purge_block(arena, block);
+                }
+            }
+            block = block_next;
+        }
+    }
+    // The trim pad decays by half per pass
+    arena->top_keep /= 2;
+    return released;
+}
+#endif /* MM_PURGE */
+
+/*
+ * lock_arena/unlock_arena, lock_sbrk/unlock_sbrk, lock_init/unlock_init:
+ *     guard an arena's lists, the heap top and heap initialization. Lock
+ *     order is arena, then init, then sbrk. They compile to nothing in the
+ *     single-threaded (MM_TCACHE == 0) build, except that lock_arena still
+ *     folds the caller's thread counters into the arena.
+ */
+static void lock_arena(arena_t *arena)
+{
+#if MM_TCACHE
+    pthread_mutex_lock(&arena->lock);
+#else
+    (void)arena;
+#endif
+#if MM_STATS
+    fold_stats(arena);
+#endif
+}
+
+static void unlock_arena(arena_t *arena)
+{
+#if MM_TCACHE
+    pthread_mutex_unlock(&arena->lock);
+#else
+    (void)arena;
+#endif
+}
+
+static void lock_sbrk(void)
+{
+#if MM_TCACHE
+    pthread_mutex_lock(&sbrk_lock);
+#endif
+}
+
+static void unlock_sbrk(void)
+{
+#if MM_TCACHE
+    pthread_mutex_unlock(&sbrk_lock);
+#endif
+}
+
+static void lock_init(void)
+{
+#if MM_TCACHE
+    pthread_mutex_lock(&init_lock);
+#endif
+}
 
-        write_header(block_next, get_size(block_next), true, false, false);
+static void unlock_init(void)
+{
+#if MM_TCACHE
+    pthread_mutex_unlock(&init_lock);
+#endif
+}
 
-        block = block_prev;
+/*
+ * lock_arenas/unlock_arenas: take or release every arena lock, in index
+ *     order, freezing the whole heap layout.
+ */
+static void lock_arenas(void)
+{
+    for (int a = 0; a < MM_ARENAS; a++) {
+        lock_arena(&arenas[a]);
     }
+}
 
-    else                                     // Case 4
-    {
-        block_t *block_prev_2 = find_prev(block);
-        size += get_size(block_next) + get_size(block_prev_2);
-
-        bool prev_prev_alloc = get_prev_alloc(block_prev_2);
-        bool prev_prev_mini = get_prev_mini(block_prev_2);
+static void unlock_arenas(void)
+{
+    for (int a = MM_ARENAS - 1; a >= 0; a--) {
+        unlock_arena(&arenas[a]);
+    }
+}
 
-        remove_free_block(block_prev_2);
-        remove_free_block(block_next);
+/*
+ * get_arena: returns the calling thread's arena, assigning one round-robin
+ *            on first use.
+ */
+static arena_t *get_arena(void)
+{
+#if MM_ARENAS > 1
+    if (thread_arena == NULL) {
+        unsigned n = __atomic_fetch_add(&next_arena, 1, __ATOMIC_RELAXED);
+        thread_arena = &arenas[n % MM_ARENAS];
+    }
+    return thread_arena;
+#else
+    return &arenas[0];
+#endif
+}
 
-        write_header(block_prev_2, size, false, prev_prev_alloc, prev_prev_mini);
-        write_footer(block_prev_2, size, false, prev_prev_alloc, prev_prev_mini);
+/*
+ * arena_of: returns the arena owning the block or slab object at the
+ *           payload p, from the page map filled in by extend_heap.
+ */
+static arena_t *arena_of(const void *p)
+{
+#if MM_ARENAS > 1
+    uintptr_t page = ((uintptr_t)p >> PAGE_SHIFT) - heap_base_page;
+    return &arenas[page_map[page] & PAGE_ARENA];
+#else
+    (void)p;
+    return &arenas[0];
+#endif
+}
 
-        block_t *block_next_update = find_next(block_prev_2);
-        write_header(block_next_update, get_size(block_next_update), true, false, false);
-        block = block_prev_2;
+/*
+ * map_arena: records arena as the owner of every page in [lo, hi], none of
+ *            which is a run. The caller holds sbrk_lock.
+ */
+static void map_arena(arena_t *arena, const void *lo, const void *hi)
+{
+#if PAGE_MAP
+    uintptr_t first = ((uintptr_t)lo >> PAGE_SHIFT) - heap_base_page;
+    uintptr_t last = ((uintptr_t)hi >> PAGE_SHIFT) - heap_base_page;
+    memset(&page_map[first], (int)(arena - arenas), last - first + 1);
+    if (last + 1 > page_map_top) {
+        __atomic_store_n(&page_map_top, last + 1, __ATOMIC_RELEASE);
     }
-    insert_free_block(block);
-    return block;
+#else
+    (void)arena;
+    (void)lo;
+    (void)hi;
+#endif
 }
 
 /*
- * place: Places block with size of asize at the start of bp. If the remaining
- *        size is at least the minimum block size, then split the block to the
- *        the allocated block and the remaining block as free, which is then
- *        inserted into the segregated list. Requires that the block is
- *        initially unallocated.
+ * push_remote: hands an allocated block back to an arena the caller does not
+ *              own. Lock-free: the payload is pushed onto the arena's
+ *              remote_frees stack, linked through its first word.
  */
-static void place(block_t *block, size_t asize)
+static void push_remote(arena_t *arena, void *bp)
 {
-    size_t csize = get_size(block);
+    void *head = __atomic_load_n(&arena->remote_frees, __ATOMIC_RELAXED);
+
+    stat_add(thread_stats.remote_frees, 1);
+    do {
+        *(void **)bp = head;
+    } while (!__atomic_compare_exchange_n(&arena->remote_frees, &head, bp,
+                                          true, __ATOMIC_RELEASE,
+                                          __ATOMIC_RELAXED));
+}
 
-    remove_free_block(block);
-    bool prev_mini = get_prev_mini(block);
+/*
+ * drain_remote: frees every block or slab object other threads have pushed
+ *               onto the arena's remote_frees stack. The caller holds the
+ *               arena lock.
+ */
+static void drain_remote(arena_t *arena)
+{
+    if (__atomic_load_n(&arena->remote_frees, __ATOMIC_RELAXED) == NULL) {
+        return;
+    }
+    void *bp = __atomic_exchange_n(&arena->remote_frees, NULL,
+                                   __ATOMIC_ACQUIRE);
+    while (bp != NULL) {
+        void *next = *(void **)bp;
+        free_payload(arena, bp);
+        bp = next;
+    }
+}
 
-    write_header(block, asize, true, true, prev_mini);
-    block_t *block_next = find_next(block);
+#if MM_SLAB
+/*
+ * slab_bin: slab class of a request of size bytes; class i holds objects
+ *           of (i+1)*16 bytes.
+ */
+static size_t slab_bin(size_t size)
+{
+    return (size - 1) / ALIGNMENT;
+}
 
-    if ((csize - asize) == dsize) {
-        if (asize == dsize) {
-            write_header(block_next, dsize, false, true, true);
+/*
+ * run_of: returns the run holding the slab object at bp.
+ */
+static run_t *run_of(const void *bp)
+{
+    return (run_t *)((uintptr_t)bp & ~(PAGE_SIZE - 1));
+}
 
-        } else {
-            write_header(block_next, dsize, false, true, false);
-            write_footer(block_next, dsize, false, true, false);
-        }
+/*
+ * is_slab: returns true if bp is a slab object, i.e. lies on a run page.
+ *          Pointers outside the heap, such as mapped blocks, fall outside
+ *          the page map.
+ */
+static bool is_slab(const void *bp)
+{
+    uintptr_t page = ((uintptr_t)bp >> PAGE_SHIFT) - heap_base_page;
+    return page < __atomic_load_n(&page_map_top, __ATOMIC_ACQUIRE)
+           && (page_map[page] & PAGE_RUN);
+}
 
-        block_t *block_next_2 = find_next(block_next);
-        size_t size_next_2 = get_size(block_next_2);
-        write_header(block_next_2, size_next_2, true, false, true);
+/*
+ * slab_alloc: takes a free object of class bin from the arena's first run
+ *             with room, carving a new run when all are full. The caller
+ *             holds the arena lock. Returns NULL on failure.
+ */
+static void *slab_alloc(arena_t *arena, size_t bin)
+{
+    run_t *run = arena->runs[bin];
+
+    if (run == NULL) {
+        // Remote frees may refill a run before a new one is needed
+        drain_remote(arena);
+        run = arena->runs[bin];
+        if (run == NULL && (run = new_run(arena, bin)) == NULL) {
+            return NULL;
+        }
+    }
+    int w = 0;
+    while (run->free_map[w] == 0) {
+        w++;
+    }
+    int i = __builtin_ctzl(run->free_map[w]);
+    run->free_map[w] &= run->free_map[w] - 1;
+    if (--run->nfree == 0) {
+        unlink_run(arena, run);
+    }
+    stat_add(arena->stats.class_allocs[get_number(run->size)], 1);
+    return (char *)run + RUN_HEADER + (size_t)(64 * w + i) * run->size;
+}
 
-        block_t_2 *block_mini = (block_t_2 *) block_next;
-        insert_free_block_mini(block_mini);
-        return;
+/*
+ * slab_free: returns a slab object to its run; the caller holds the lock
+ *            of the arena owning it. A run that becomes entirely free is
+ *            released as a heap block, unless it is the only run of its
+ *            class with free objects.
+ */
+static void slab_free(arena_t *arena, void *bp)
+{
+    run_t *run = run_of(bp);
+    size_t i = ((char *)bp - (char *)run - RUN_HEADER) / run->size;
+
+    run->free_map[i / 64] |= (uint64_t)1 << (i % 64);
+    run->nfree++;
+    if (run->nfree == 1) {
+        link_run(arena, run);
+    } else if (run->nfree == run->nobjs
+               && (arena->runs[run->bin] != run || run->next != NULL)) {
+        unlink_run(arena, run);
+        page_map[((uintptr_t)run >> PAGE_SHIFT) - heap_base_page] &= ~PAGE_RUN;
+        stat_add(arena->stats.slab_runs, -1);
+        free_block(arena, payload_to_header(run));
     }
-    else if ((csize - asize) > dsize) {
-        if (asize == dsize) {
-            write_header(block_next, csize-asize, false, true, true);
-            write_footer(block_next, csize-asize, false, true, true);
-        } else {
-            write_header(block_next, csize-asize, false, true, false);
-            write_footer(block_next, csize-asize, false, true, false);
-        }
+}
 
-        block_t *block_next_2 = find_next(block_next);
-        size_t size_next_2 = get_size(block_next_2);
-        write_header(block_next_2, size_next_2, true, false, false);
+/*
+ * new_run: carves a page-aligned page out of the arena and sets it up as
+ *          an empty run of class bin, on the arena's list for the class.
+ */
+static run_t *new_run(arena_t *arena, size_t bin)
+{
+    block_t *block = alloc_aligned(arena, PAGE_SIZE, PAGE_SIZE + dsize);
 
-        insert_free_block(block_next);
-        return;
+    if (block == NULL) {
+        return NULL;
     }
-    else { 
-        if (csize == dsize) {
-            write_header(block_next, get_size(block_next), true, true, true);
+    run_t *run = header_to_payload(block);
+    run->size = (bin + 1) * ALIGNMENT;
+    run->bin = bin;
+    run->nobjs = (PAGE_SIZE - RUN_HEADER) / run->size;
+    run->nfree = run->nobjs;
+    for (unsigned w = 0; w < RUN_MAP_WORDS; w++) {
+        unsigned first = 64 * w;
+        if (first + 64 <= run->nobjs) {
+            run->free_map[w] = ~(uint64_t)0;
+        } else if (first < run->nobjs) {
+            run->free_map[w] = ((uint64_t)1 << (run->nobjs - first)) - 1;
         } else {
-            write_header(block_next, get_size(block_next), true, true, false);
+            run->free_map[w] = 0;
         }
     }
+    page_map[((uintptr_t)run >> PAGE_SHIFT) - heap_base_page] |= PAGE_RUN;
+    link_run(arena, run);
+    stat_add(arena->stats.slab_runs, 1);
+    return run;
 }
 
-static int get_number(size_t size) {
-    if (size < 80) {
-        return 0;
-    }
-    else if (size < 200) {
-        return 1;
-    }
-    else if (size < 300) {
-        return 2;
-    }
-    if (size < 430) {
-        return 3;
+/*
+ * link_run/unlink_run: add a run to, or remove it from, the arena's list
+ *                      of runs of its class that have free objects.
+ */
+static void link_run(arena_t *arena, run_t *run)
+{
+    run->prev = NULL;
+    run->next = arena->runs[run->bin];
+    if (run->next != NULL) {
+        run->next->prev = run;
     }
-    if (size < 840) {
-        return 4;
+    arena->runs[run->bin] = run;
+}
+
+static void unlink_run(arena_t *arena, run_t *run)
+{
+    if (run->prev == NULL) {
+        arena->runs[run->bin] = run->next;
+    } else {
+        run->prev->next = run->next;
     }
-    else if (size < 1500){
-        return 5;
-    } 
-    else {
-        return 6;
+    if (run->next != NULL) {
+        run->next->prev = run->prev;
     }
-} 
+}
+#endif /* MM_SLAB */
 
+#if MM_TCACHE
 /*
- * find_fit: Looks for a free block with at least asize bytes with
- *           first-fit policy. Returns NULL if none is found.
+ * tcache_check_epoch: forgets every cached block if the heap has been
+ *                     re-initialized since the thread last touched it.
  */
-static block_t *find_fit(size_t asize)
+static void tcache_check_epoch(tcache_t *tc)
 {
-    if (asize == dsize) {
-        if (mini_listp != NULL) {
-            return (block_t *) mini_listp;
-        }
+    if (tc->epoch != heap_epoch) {
+        memset(tc->count, 0, sizeof(tc->count));
+        tc->epoch = heap_epoch;
     }
-    block_t *block;
+}
 
-    for (int i = get_number(asize); i < LIST_NUM; ++i) {
-        for (block = free_listp_array_tail[i]; block != NULL; block = block->prev) {
-            if ((asize <= get_size(block))) {
-                return block;
-            }
-        }
-    }
+/*
+ * tcache_pop: takes a payload of magazine bin from the calling thread's
+ *             magazine without locking. Returns NULL if the magazine is empty.
+ */
+static void *tcache_pop(size_t bin)
+{
+    tcache_t *tc = &tcache;
 
-    return NULL; // no fit found
+    tcache_check_epoch(tc);
+    if (tc->count[bin] == 0) {
+        return NULL;
+    }
+    stat_add(thread_stats.tcache_hits, 1);
+    return tc->slots[bin][--tc->count[bin]];
 }
 
-static void remove_mini_free_block(block_t_2 *pointer)
+/*
+ * tcache_alloc: allocates one object or block for magazine bin from the
+ *               arena, whose lock the caller holds.
+ */
+static void *tcache_alloc(arena_t *arena, size_t bin)
 {
-    if (mini_listp == pointer) {
-        mini_listp = mini_listp->next;
-        return;
-    }
-    block_t_2 *block_prev = NULL;
-    block_t_2 *block_curr = mini_listp;
-    while(block_curr != NULL && block_curr != pointer) {
-        block_prev = block_curr;
-        block_curr = block_curr->next;
-    }
-    if (block_curr != NULL) {
-        block_prev->next = block_curr->next;
-        block_curr->next = NULL;
+    size_t size = (bin + 1) * dsize;
+
+#if MM_SLAB
+    if (size <= MM_SLAB_MAX) {
+        return slab_alloc(arena, bin);
     }
+#endif
+    return malloc_block(arena, size);
 }
+
 /*
- * remove free blocks in from the free list
+ * tcache_refill: magazine miss. Takes the arena lock once and allocates
+ *                half a magazine worth of objects or blocks for bin from
+ *                the arena; returns one of them, or NULL on failure.
  */
-static void remove_free_block(block_t* pointer) {
-    // printf("remove address: %p\n", pointer);
-    size_t size = get_size(pointer);
-    if (size == dsize) {
-        block_t_2 *block_mini = (block_t_2 *)pointer;
-        remove_mini_free_block(block_mini);
-        return;
-    }
+static void *tcache_refill(size_t bin)
+{
+    tcache_t *tc = &tcache;
+    arena_t *arena = get_arena();
+    void *bp;
 
-    block_t* block_prev = pointer->prev;
-    block_t* block_next = pointer->next;
+    tcache_register(tc);
+    lock_arena(arena);
+    stat_add(arena->stats.tcache_refills, 1);
+    bp = tcache_alloc(arena, bin);
+    while (bp != NULL && tc->count[bin] < MM_TCACHE_COUNT / 2) {
+        void *extra = tcache_alloc(arena, bin);
+        if (extra == NULL) {
+            break;
+        }
+        tc->slots[bin][tc->count[bin]++] = extra;
+    }
+    unlock_arena(arena);
+    // malloc_block may have re-initialized the heap
+    tc->epoch = heap_epoch;
+    return bp;
+}
 
-    int free_list_number = get_number(get_size(pointer));
+/*
+ * tcache_push: returns a payload to magazine bin of the calling thread.
+ *              A full magazine first flushes its older half back to the
+ *              arenas.
+ */
+static void tcache_push(void *bp, size_t bin)
+{
+    tcache_t *tc = &tcache;
 
-    /* case 1: remove block when there is only one block in the list */
-    if (block_prev == NULL && block_next == NULL) {
-        free_listp_array[free_list_number] = NULL;
-        free_listp_array_tail[free_list_number] = NULL;
-    } 
-    /* Case 2: remove the top element of the list*/
-    else if (block_prev == NULL && block_next != NULL) {
-        free_listp_array[free_list_number] = block_next;
-        free_listp_array[free_list_number]->prev = NULL;
-    }
-    /*Case 3: remove the last element of the list */
-    else if (block_prev != NULL && block_next == NULL) {
-        block_prev->next = NULL;
-        free_listp_array_tail[free_list_number] = block_prev;
-    }
-    /*Case 4: remove the element in the middle*/
-    else if (block_prev != NULL && block_next != NULL){
-        block_prev->next = block_next;
-        block_next->prev = block_prev;
+    tcache_check_epoch(tc);
+    tcache_register(tc);
+    if (tc->count[bin] == MM_TCACHE_COUNT) {
+        tcache_flush(tc, bin, MM_TCACHE_COUNT / 2);
     }
+    tc->slots[bin][tc->count[bin]++] = bp;
 }
 
-static void insert_free_block(block_t* pointer) {
-    size_t size = get_size(pointer);
-    int free_list_number = get_number(size);
+/*
+ * tcache_flush: frees the n oldest entries of one bin, under a single lock
+ *               of the thread's arena. Entries owned by other arenas are
+ *               sent back to them as remote frees.
+ */
+static void tcache_flush(tcache_t *tc, size_t bin, unsigned n)
+{
+    arena_t *arena = get_arena();
+
+    lock_arena(arena);
+    stat_add(arena->stats.tcache_flushes, 1);
+    for (unsigned i = 0; i < n; i++) {
+        void *bp = tc->slots[bin][i];
+        arena_t *owner = arena_of(bp);
+        if (owner == arena) {
+            free_payload(arena, bp);
+        } else {
+            push_remote(owner, bp);
+        }
+    }
+    unlock_arena(arena);
+    tc->count[bin] -= n;
+    memmove(tc->slots[bin], tc->slots[bin] + n,
+            tc->count[bin] * sizeof(void *));
+}
 
-    if (free_listp_array[free_list_number] == NULL) {
-        free_listp_array[free_list_number] = pointer;
-        free_listp_array_tail[free_list_number] = pointer;
-        pointer->prev = NULL;
-        pointer->next = NULL;
-        return;
+/*
+ * tcache_register: arranges for the magazines to be flushed when the
+ *                  thread exits, so its cached blocks are not leaked.
+ */
+static void tcache_register(tcache_t *tc)
+{
+    if (!tc->registered) {
+        pthread_once(&tcache_key_once, tcache_key_init);
+        pthread_setspecific(tcache_key, tc);
+        tc->registered = true;
     }
-    pointer->prev = NULL;
-    pointer->next = free_listp_array[free_list_number];
-    free_listp_array[free_list_number]->prev = pointer;
-     /* update the free_listp */
-    free_listp_array[free_list_number] = pointer;
 }
 
-static void insert_free_block_mini(block_t_2 *pointer) {
-    if (mini_listp == NULL) {
-        mini_listp = pointer;
-        mini_listp->next = NULL;
-        return;
+static void tcache_key_init(void)
+{
+    pthread_key_create(&tcache_key, tcache_destroy);
+}
+
+/*
+ * tcache_destroy: thread-exit hook; hands every cached block back.
+ */
+static void tcache_destroy(void *arg)
+{
+    tcache_t *tc = (tcache_t *)arg;
+
+    tcache_check_epoch(tc);
+    for (size_t bin = 0; bin < TCACHE_BINS; bin++) {
+        if (tc->count[bin] > 0) {
+            tcache_flush(tc, bin, tc->count[bin]);
+        }
     }
-    pointer->next = mini_listp;
-     /* update the free_listp */
-    mini_listp = pointer;
+#if MM_STATS
+    // Hand the thread's counters to its arena before they are lost
+    arena_t *arena = get_arena();
+    lock_arena(arena);
+    unlock_arena(arena);
+#endif
+    tc->registered = false;
 }
+#endif /* MM_TCACHE */
 
 /*
  * max: returns x if x > y, and y otherwise.
@@ -696,6 +4084,17 @@ static word_t pack(size_t size, bool alloc, bool prev_alloc, bool prev_mini)
 }
 
 
+/*
+ * load_header: reads a block's header word. free reads the size of its
+ *              own block without the arena lock while the arena may be
+ *              rewriting the prev bits of that same word, so header
+ *              accesses are relaxed atomics (plain moves on x86).
+ */
+static word_t load_header(block_t *block)
+{
+    return __atomic_load_n(&block->header, __ATOMIC_RELAXED);
+}
+
 /*
  * extract_size: returns the size of a given header value based on the header
  *               specification above.
@@ -711,7 +4110,7 @@ static size_t extract_size(word_t word)
  */
 static size_t get_size(block_t *block)
 {
-    return extract_size(block->header);
+    return extract_size(load_header(block));
 }
 
 /*
@@ -746,24 +4145,45 @@ static bool extract_prev_mini(word_t word) {
  */
 static bool get_alloc(block_t *block)
 {
-    return extract_alloc(block->header);
+    return extract_alloc(load_header(block));
 }
 
 static bool get_prev_alloc(block_t *block) {
-    return extract_prev_alloc(block->header);
+    return extract_prev_alloc(load_header(block));
 }
 
 static bool get_prev_mini(block_t *block)
 {
-    return extract_prev_mini(block->header);
+    return extract_prev_mini(load_header(block));
+}
+
+#if MM_MMAP_THRESHOLD > 0
+/*
+ * get_mmapped: returns true when an allocated block lives in its own
+ *              mapping rather than in the heap.
+ */
+static bool get_mmapped(block_t *block)
+{
+    return (bool)(load_header(block) & mmap_mask);
 }
+#endif
 /*
  * write_header: given a block and its size and allocation status,
  *               writes an appropriate value to the block header.
  */
 static void write_header(block_t *block, size_t size, bool alloc, bool prev_alloc, bool prev_mini)
 {
-    block->header = pack(size, alloc, prev_alloc, prev_mini);
+    __atomic_store_n(&block->header, pack(size, alloc, prev_alloc, prev_mini),
+                     __ATOMIC_RELAXED);
+}
+
+/*
+ * set_prev_bits: tells block that its predecessor changed, rewriting the
+ *                prev bits of its header and keeping its size and state.
+ */
+static void set_prev_bits(block_t *block, bool prev_alloc, bool prev_mini)
+{
+    write_header(block, get_size(block), get_alloc(block), prev_alloc, prev_mini);
 }
 
 /*
@@ -774,7 +4194,7 @@ static void write_header(block_t *block, size_t size, bool alloc, bool prev_allo
 static void write_footer(block_t *block, size_t size, bool alloc, bool prev_alloc, bool prev_mini)
 {
     if (!alloc && size > dsize) {
-        word_t *footerp = (word_t *)((block->payload) - 16 + get_size(block) - dsize);  /* pay attention to 16 and char() */ // <Important>
+        word_t *footerp = (word_t *)((char *)block + get_size(block) - wsize);
         *footerp = pack(size, alloc, prev_alloc, prev_mini);
     }
 }
@@ -819,6 +4239,17 @@ static block_t *find_prev(block_t *block)
     }
 }
 
+/*
+ * is_epilogue: whether block is the epilogue, the size-0 header at the end
+ *              of the heap, rather than the end of an inner region. It
+ *              checks the address, so the caller must keep the heap top
+ *              from moving, by holding sbrk_lock or every arena lock.
+ */
+static bool is_epilogue(block_t *block)
+{
+    return (char *)block + wsize > (char *)mem_heap_hi();
+}
+
 /*
  * payload_to_header: given a payload pointer, returns a pointer to the
  *                    corresponding block.
@@ -835,13 +4266,13 @@ static block_t *payload_to_header(void *bp)
 
 static void *header_to_payload(block_t *block)
 {
-    return (void *)(block->payload - 16); /* change block->payload to block->prev */ //<Important>//
+    return (void *)((char *)block + offsetof(block_t, prev));
 }
 
 static void *header_to_payload_mini(block_t_2 *block)
 {
     block_t *block_normal = (block_t *) block;
-    return (void *)(block_normal->payload - 16);
+    return header_to_payload(block_normal);
 }
 
 /*
@@ -1003,3 +4434,118 @@ static int explict_list_check(int lineno, int explicit_free_count) {
     return explicit_free_count;
 }
 
+
+/*
+ * mm_frag_step: advances a fragmentation walk by at most max_blocks blocks
+ *               (all of them if 0). The walk goes from heap_listp to the
+ *               epilogue like mm_checkheap, but tallies instead of checking.
+ *               All arena locks are held during a step only, so the heap
+ *               keeps changing between steps: blocks freed or merged behind
+ *               the cursor are missed, and the totals are a sample rather
+ *               than a snapshot. Returns true once the walk is done.
+ */
+bool mm_frag_step(mm_frag_t *frag, size_t max_blocks)
+{
+    lock_arenas();
+    block_t *block = __atomic_load_n(&frag_cursor, __ATOMIC_RELAXED);
+    if (frag->done || frag->epoch != heap_epoch || frag_walker != frag) {
+        // Start over: a new walk, a new heap, or another walk took over
+        memset(frag, 0, sizeof(*frag));
+        frag->epoch = heap_epoch;
+        frag_walker = frag;
+        block = heap_listp;
+    }
+    for (size_t n = 0; block != NULL && !is_epilogue(block); n++) {
+        if (max_blocks != 0 && n == max_blocks) {
+            break;
+        }
+        size_t size = get_size(block);
+        block_t *next = find_next(block);
+        if (size == 0) {
+            // The end of a region; the next one starts after a pad word
+            next = (block_t *)((char *)block + dsize);
+        } else {
+            frag_visit(frag, block, size);
+        }
+        block = next;
+    }
+    frag->done = (block == NULL || is_epilogue(block));
+    if (frag->done) {
+        block = NULL;
+        frag_walker = NULL;
+        if (frag->free_bytes > 0) {
+            frag->fragmentation = 1.0 - (double)frag->largest_free / frag->free_bytes;
+        }
+    }
+    __atomic_store_n(&frag_cursor, block, __ATOMIC_RELAXED);
+    unlock_arenas();
+    return frag->done;
+}
+
+/*
+ * mm_frag_run: advances a fragmentation walk for about budget_ns
+ *              nanoseconds, in steps of MM_FRAG_STEP blocks. Returns true
+ *              once the walk is done.
+ */
+bool mm_frag_run(mm_frag_t *frag, uint64_t budget_ns)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    uint64_t start = (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+    while (!mm_frag_step(frag, MM_FRAG_STEP)) {
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        if ((uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec - start >= budget_ns) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/*
+ * frag_visit: adds one block to the walk's tallies. Allocated blocks cost
+ *             their header, slab runs their header and unused tail. The
+ *             requested sizes are not stored, so the round_up padding is
+ *             estimated at (ALIGNMENT - 1) / 2 bytes per allocated object,
+ *             its mean for evenly spread request sizes.
+ */
+static void frag_visit(mm_frag_t *frag, block_t *block, size_t size)
+{
+    frag->blocks++;
+    if (!get_alloc(block)) {
+        int bucket = 63 - __builtin_clzl(size) - 4;
+        frag->free_blocks++;
+        frag->free_bytes += size;
+        frag->largest_free = max(frag->largest_free, size);
+        frag->free_hist[(bucket < MM_FRAG_BUCKETS) ? bucket : MM_FRAG_BUCKETS - 1]++;
+        frag->class_free_bytes[get_number(size)] += size;
+        return;
+    }
+    frag->alloc_blocks++;
+    frag->alloc_bytes += size;
+#if MM_SLAB
+    if (is_slab(header_to_payload(block))) {
+        run_t *run = header_to_payload(block);
+        frag->slab_runs++;
+        frag->slab_free_bytes += (size_t)run->nfree * run->size;
+        frag->overhead_bytes += size - (size_t)run->nobjs * run->size;
+        frag->padding_estimate += (uint64_t)(run->nobjs - run->nfree) * (ALIGNMENT - 1) / 2;
+        return;
+    }
+#endif
+    frag->overhead_bytes += wsize;
+    frag->padding_estimate += (ALIGNMENT - 1) / 2;
+}
+
+/*
+ * merge_boundary: the block boundary at gone disappears in a merge. A
+ *                 paused walk that would resume there skips to the
+ *                 following block. The caller holds the lock of the arena
+ *                 owning gone.
+ */
+static void merge_boundary(block_t *gone)
+{
+    if (__atomic_load_n(&frag_cursor, __ATOMIC_RELAXED) == gone) {
+        __atomic_store_n(&frag_cursor, find_next(gone), __ATOMIC_RELAXED);
+    }
+}
@@ -0,0 +1,190 @@
+/*
+ * mm_ext.h
+ *
+ * Entry points of mm.c beyond the malloc/free/realloc/calloc interface
+ * declared in mm.h.
+ */
+#ifndef MM_EXT_H
+#define MM_EXT_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+ * mm_trim: returns every free heap page it can to the OS right away.
+ *          Returns the number of bytes released.
+ */
+size_t mm_trim(void);
+
+/*
+ * mm_background_start: starts a thread that coalesces, trims and purges
+ *                      every interval_ns nanoseconds, so that free does
+ *                      not; malloc still coalesces when nothing fits.
+ *                      Returns false if one is running already or mm.c
+ *                      was built without MM_BACKGROUND (which needs
+ *                      MM_LAZY_COALESCE).
+ */
+bool mm_background_start(uint64_t interval_ns);
+
+/*
+ * mm_background_stop: stops that thread, if any, and waits for it.
+ */
+void mm_background_stop(void);
+
+#ifdef DRIVER
+/*
+ * Aligned allocation and sized free. Outside the driver build mm.c defines
+ * memalign, posix_memalign, aligned_alloc, malloc_usable_size and
+ * free_sized themselves; the driver build prefixes them with mm_ like the
+ * rest of mm.h. Aligned blocks are released with mm_free.
+ */
+void *mm_memalign(size_t alignment, size_t size);
+int mm_posix_memalign(void **memptr, size_t alignment, size_t size);
+void *mm_aligned_alloc(size_t alignment, size_t size);
+
+/*
+ * mm_usable_size: bytes usable at ptr, at least the size it was allocated
+ *                 with (malloc_usable_size outside the driver build).
+ */
+size_t mm_usable_size(void *ptr);
+
+/*
+ * mm_free_sized: frees ptr, which was returned by mm_malloc, mm_calloc or
+ *                mm_realloc for exactly size bytes (free_sized outside
+ *                the driver build). Faster than mm_free for small objects.
+ */
+void mm_free_sized(void *ptr, size_t size);
+#endif
+
+/*
+ * mm_malloc_batch: allocates n objects of size bytes into out at the cost
+ *                  of about one allocation. Returns how many it allocated,
+ *                  which is less than n only when memory runs out. Each
+ *                  object is freed with mm_free or mm_free_batch.
+ */
+size_t mm_malloc_batch(size_t size, size_t n, void **out);
+
+/*
+ * mm_free_batch: frees the n pointers of ptrs, which may include NULL.
+ *                Adjacent blocks are merged before they are freed. ptrs is
+ *                used as scratch space; its contents are undefined after.
+ */
+void mm_free_batch(void **ptrs, size_t n);
+
+/* Number of segregated free-list classes */
+#define MM_STATS_CLASSES 64
+
+/*
+ * mm_stats_t: a snapshot of the allocator's counters. Counts run from the
+ * last mm_init. Built with -DMM_STATS=0, only heap_bytes, purged_bytes and
+ * trimmed_bytes are filled in.
+ */
+typedef struct mm_stats {
+    uint64_t heap_bytes;        // size of the sbrk heap
+    uint64_t mapped_bytes;      // held by blocks with their own mapping
+    uint64_t mapped_blocks;
+    uint64_t in_use_bytes;      // block and object sizes not yet freed
+    uint64_t in_use_count;
+    uint64_t allocs;            // successful malloc/calloc/realloc results
+    uint64_t alloc_bytes;
+    uint64_t frees;
+    uint64_t freed_bytes;
+    uint64_t free_bytes;        // in the free lists
+    uint64_t free_blocks[MM_STATS_CLASSES]; // per class; 0 includes mini blocks
+    uint64_t class_allocs[MM_STATS_CLASSES]; // served by an arena, per class
+    uint64_t slab_runs;         // pages carved into small objects
+    uint64_t tcache_hits;       // allocations served by a thread magazine
+    uint64_t tcache_refills;
+    uint64_t tcache_flushes;
+    uint64_t remote_frees;      // frees handed to another thread's arena
+    uint64_t lazy_hits;         // allocations served by a quick list
+    uint64_t lazy_bytes;        // freed, parked on quick lists uncoalesced
+    uint64_t extend_heap;       // heap growth calls and bytes
+    uint64_t extend_heap_bytes;
+    uint64_t extend_heap_overshoot; // grown beyond the requests that needed it
+    uint64_t coalesce[4];       // coalesce calls by case: none, next, prev, both
+    uint64_t purged_bytes;      // released with madvise
+    uint64_t trimmed_bytes;     // released by shrinking the heap
+} mm_stats_t;
+
+/*
+ * mm_stats: returns the current counters, summed over all arenas.
+ */
+mm_stats_t mm_stats(void);
+
+/*
+ * mm_stats_json: formats mm_stats() as a single-line JSON object into buf,
+ *                with snprintf semantics. Classes are arrays indexed by
+ *                class number; "class_min_size" gives each class's
+ *                smallest block size.
+ */
+size_t mm_stats_json(char *buf, size_t size);
+
+/* Free-block size buckets of mm_frag_t: bucket i holds [16 << i, 32 << i) */
+#define MM_FRAG_BUCKETS 32
+
+/*
+ * mm_frag_t: result and state of a heap walk by mm_frag_step. Zero it
+ * before the first step; a finished walk starts over on the next step.
+ * Blocks sitting in thread magazines count as allocated.
+ */
+typedef struct mm_frag {
+    uint64_t blocks;            // blocks walked so far
+    uint64_t alloc_blocks;      // allocated blocks, slab runs included
+    uint64_t alloc_bytes;
+    uint64_t free_blocks;
+    uint64_t free_bytes;
+    uint64_t largest_free;
+    uint64_t free_hist[MM_FRAG_BUCKETS]; // free blocks by size
+    uint64_t class_free_bytes[MM_STATS_CLASSES]; // free bytes per class
+    uint64_t slab_runs;
+    uint64_t slab_free_bytes;   // free objects inside slab runs
+    uint64_t overhead_bytes;    // block headers, run headers and run tails
+    uint64_t padding_estimate;  // bytes lost to rounding request sizes up
+    double fragmentation;       // 1 - largest_free / free_bytes, when done
+    bool done;                  // the walk reached the end of the heap
+    unsigned epoch;             // heap the walk belongs to (private)
+} mm_frag_t;
+
+/*
+ * mm_frag_step: continues the walk by at most max_blocks blocks, or to the
+ *               end if max_blocks is 0. The arenas are locked only during
+ *               the step, so a long walk is a sample of a changing heap.
+ *               Only one walk is kept at a time; starting another one
+ *               restarts it. Returns true when the walk is done.
+ */
+bool mm_frag_step(mm_frag_t *frag, size_t max_blocks);
+
+/*
+ * mm_frag_run: continues the walk for about budget_ns nanoseconds.
+ *              Returns true when the walk is done.
+ */
+bool mm_frag_run(mm_frag_t *frag, uint64_t budget_ns);
+
+/*
+ * mm_profile_start: starts sampling about one allocation every rate bytes
+ *                   allocated, recording its size class, call stack and,
+ *                   once freed, its lifetime. The previous profile is
+ *                   discarded. mm_profile_start(0) stops sampling and keeps
+ *                   the profile for reporting. Returns false if mm.c was
+ *                   built without the profiler (MM_PROFILE=0).
+ */
+bool mm_profile_start(size_t rate);
+
+/*
+ * mm_profile_dump: writes the sampled call stacks to fd, folded for
+ *                  flamegraph.pl and weighted by the estimated bytes
+ *                  allocated at each, or by those still live if live is
+ *                  set. Returns 0 on success and -1 on failure.
+ */
+int mm_profile_dump(int fd, bool live);
+
+/*
+ * mm_profile_json: the size-class histogram of the samples and per-site
+ *                  totals, including mean lifetimes, as one JSON object.
+ *                  Same buffer semantics as mm_stats_json.
+ */
+size_t mm_profile_json(char *buf, size_t size);
+
+#endif /* MM_EXT_H */
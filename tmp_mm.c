@@ -31,7 +31,7 @@
 #define dbg_printheap(...) print_heap(__VA_ARGS__)
 #else
 /* When debugging is disabled, no code gets generated */
-#define dbg_printf(...) printf(__VA_ARGS__)
+#define dbg_printf(...)
 #define dbg_assert(...)
 #define dbg_requires(...)
 #define dbg_ensures(...)
@@ -148,13 +148,15 @@ bool mm_init(void)
     start[1] = pack(0, true); // Epilogue header
     // Heap starts with first block header (epilogue)
     heap_listp = (block_t *) &(start[1]);
+    // Forget the free list of any previous heap
+    explicit_listp = NULL;
 
     // Extend the empty heap with a free block of chunksize bytes
     if (extend_heap(chunksize) == NULL)
     {
         return false;
     }
-    mm_checkheap(157);
+    dbg_checkheap(157);
     return true;
 }
 
@@ -172,7 +174,7 @@ bool mm_init(void)
 void *malloc(size_t size) 
 {
     dbg_requires(mm_checkheap);
-    mm_checkheap(175);
+    dbg_checkheap(175);
     size_t asize;      // Adjusted block size
     size_t extendsize; // Amount to extend heap if no fit is found
     block_t *block;